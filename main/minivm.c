@@ -10,11 +10,33 @@
 vm_ast_node_t vm_lang_lua_parse(vm_config_t *config, const char *str);
 
 int main(int argc, char **argv) {
-    vm_init_mem();
+    // --gc is read first, nothing can be allocated before it is known
+    uint8_t gc = VM_USE_LEAKS;
+    for (size_t i = 1; i < argc && strcmp(argv[i], "--"); i++) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--gc=", 5)) {
+            continue;
+        }
+        arg += 5;
+        if (!strcmp(arg, "none")) {
+            gc = VM_USE_LEAKS_NOGC;
+        } else if (!strcmp(arg, "bdwgc")) {
+            gc = VM_USE_LEAKS_BDWGC;
+        } else if (!strcmp(arg, "tgc")) {
+            gc = VM_USE_LEAKS_TGC;
+        } else {
+            fprintf(stderr, "cannot use as a gc: %s\n", arg);
+            return 1;
+        }
+    }
+    vm_init_mem(gc);
     vm_config_t val_config = (vm_config_t) {
         .use_tb_opt = false,
         .use_tailcall = true,
+        .use_region = true,
         .use_num = VM_USE_NUM_I32,
+        .max_versions = VM_USE_MAX_VERSIONS,
+        .hot_runs = VM_USE_HOT_RUNS,
     };
     vm_config_t *config = &val_config;
     bool dry_run = false;
@@ -53,10 +75,53 @@ int main(int argc, char **argv) {
                 fprintf(stderr, "cannot use have as a number type: %s\n", arg);
                 return 1;
             }
+        } else if (!strncmp(arg, "--max-versions=", 15)) {
+            arg += 15;
+            char *end;
+            config->max_versions = (size_t)strtoull(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0') {
+                fprintf(stderr, "cannot use as a version limit: %s\n", arg);
+                return 1;
+            }
+        } else if (!strncmp(arg, "--hot=", 6)) {
+            arg += 6;
+            char *end;
+            config->hot_runs = (size_t)strtoull(arg, &end, 10);
+            if (*arg == '\0' || *end != '\0') {
+                fprintf(stderr, "cannot use as a run count: %s\n", arg);
+                return 1;
+            }
+        } else if (!strncmp(arg, "--gc=", 5)) {
+            // taken before vm_init_mem
         } else if (!strcmp(arg, "--tailcall")) {
             config->use_tailcall = true;
         } else if (!strcmp(arg, "--no-tailcall")) {
             config->use_tailcall = false;
+        } else if (!strcmp(arg, "--region")) {
+            config->use_region = true;
+        } else if (!strcmp(arg, "--no-region")) {
+            config->use_region = false;
+        } else if (!strcmp(arg, "--bg-jit")) {
+#if !defined(VM_TB_USE_THREADS)
+            fprintf(stderr, "--bg-jit needs <threads.h>, this build has none\n");
+            return 1;
+#endif
+            // the worker would allocate from bdwgc on a thread it does not know
+            if (gc == VM_USE_LEAKS_BDWGC) {
+                fprintf(stderr, "cannot use --bg-jit with --gc=bdwgc\n");
+                return 1;
+            }
+            config->use_bg_jit = true;
+        } else if (!strcmp(arg, "--no-bg-jit")) {
+            config->use_bg_jit = false;
+        } else if (!strcmp(arg, "--promote")) {
+            config->use_promote = true;
+        } else if (!strcmp(arg, "--no-promote")) {
+            config->use_promote = false;
+        } else if (!strcmp(arg, "--loop")) {
+            config->use_loop = true;
+        } else if (!strcmp(arg, "--no-loop")) {
+            config->use_loop = false;
         } else if (!strncmp(arg, "--dump-", 7) || !strncmp(arg, "--dump=", 7)) {
             arg += 7;
             if (!strcmp(arg, "src")) {
@@ -81,6 +146,8 @@ int main(int argc, char **argv) {
                 config->dump_args = true;
             } else if (!strcmp(arg, "time")) {
                 config->dump_time = true;
+            } else if (!strcmp(arg, "jit")) {
+                config->dump_jit = true;
             } else {
                 fprintf(stderr, "cannot dump: %s\n", arg);
                 return 1;
@@ -120,7 +187,7 @@ int main(int argc, char **argv) {
                 vm_ast_print_node(stdout, 0, "", node);
             }
             
-            vm_ast_blocks_t blocks = vm_ast_comp(node);
+            vm_ast_blocks_t blocks = vm_ast_comp(config, node);
 
             if (config->dump_ir) {
                 vm_print_blocks(stdout, blocks.len, blocks.blocks);
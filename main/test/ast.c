@@ -154,7 +154,7 @@ void vm_test(vm_config_t *config, const char *name, vm_test_func_t gen) {
 
     clock_t p2 = clock();
 
-    vm_ast_blocks_t blocks = vm_ast_comp(node);
+    vm_ast_blocks_t blocks = vm_ast_comp(config, node);
     
     clock_t p3 = clock();
 
@@ -178,7 +178,7 @@ void vm_test(vm_config_t *config, const char *name, vm_test_func_t gen) {
 #define vm_test(...) vm_test(config, __VA_ARGS__)
 
 int main(int argc, char **argv) {
-    vm_init_mem();
+    vm_init_mem(VM_USE_LEAKS);
     vm_config_t val_config = (vm_config_t) {
         .use_tb_opt = true,
         .dump_src = false,
@@ -0,0 +1,36 @@
+local function sum(t)
+    return t.a + t.b
+end
+local total = 0
+local i = 0
+while i < 1000 do
+    local t = {}
+    t.a = i
+    t.b = 3
+    local u = t
+    total = total + u.a
+    if i % 10 == 0 then
+        total = total + sum(u)
+    end
+    i = i + 1
+end
+local j = 0
+while j < 100 do
+    local s = {}
+    s.a = j
+    s.b = j
+    if s.a > 50 then
+        s.b = sum(s)
+    end
+    total = total + s.b
+    j = j + 1
+end
+local r = {}
+r.a = 1
+r.b = 2
+local k = 0
+while k < 10 do
+    r.a = r.a + sum(r)
+    k = k + 1
+end
+print(total + r.a)
@@ -0,0 +1,13 @@
+local t = {}
+local i = 1
+while i <= 1000 do
+    t[i] = i
+    i = i + 1
+end
+local sum = 0
+local j = 1
+while j <= #t do
+    sum = sum + t[j]
+    j = j + 1
+end
+print(sum)
@@ -0,0 +1,12 @@
+local x = 0
+local i = 0
+while i < 1000 do
+    if x >= 0 then
+        local t = {}
+        t.a = i
+        t.b = 7
+        x = x + t.a + t.b
+    end
+    i = i + 1
+end
+print(x)
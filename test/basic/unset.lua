@@ -0,0 +1,10 @@
+local t = {}
+local i = 0
+while i < 1000000 do
+    t[i + 100000] = i
+    t[i + 100000] = t.none
+    i = i + 1
+end
+t[5] = 1
+t.x = 2
+print(t[5] + t.x)
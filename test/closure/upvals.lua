@@ -0,0 +1,17 @@
+local a = 10
+local b = 20
+local t = {}
+t.n = 3
+
+local f = function(x)
+    return a + b * x + t.n
+end
+
+local sum = 0
+local i = 0
+while i < 1000000 do
+    sum = f(i) - sum
+    i = i + 1
+end
+
+print(sum)
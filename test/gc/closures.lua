@@ -0,0 +1,28 @@
+local function counter(start)
+    local box = {}
+    box.n = start
+    return function()
+        box.n = box.n + 1
+        return box.n
+    end
+end
+
+local keep = {}
+local n = 0
+local sum = 0
+local i = 0
+while i < 50000 do
+    local f = counter(i)
+    sum = sum + f()
+    if i % 500 == 0 then
+        keep[n] = f
+        n = n + 1
+    end
+    i = i + 1
+end
+local j = 0
+while j < n do
+    sum = sum + keep[j]()
+    j = j + 1
+end
+print(sum)
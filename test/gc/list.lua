@@ -0,0 +1,36 @@
+local slots = {}
+local k = 0
+while k < 64 do
+    slots[k] = {}
+    slots[k].v = 0
+    slots[k].n = 0
+    k = k + 1
+end
+local i = 0
+while i < 400000 do
+    local node = {}
+    node.v = i
+    node.next = slots[i % 64]
+    node.n = node.next.n + 1
+    slots[i % 64] = node
+    if i % 7 == 0 then
+        local drop = {}
+        drop.v = i
+        drop.n = 0
+        slots[i % 64] = drop
+    end
+    i = i + 1
+end
+local sum = 0
+k = 0
+while k < 64 do
+    local cur = slots[k]
+    local n = cur.n
+    while n > 0 do
+        sum = sum + cur.v % 1000
+        cur = cur.next
+        n = n - 1
+    end
+    k = k + 1
+end
+print(sum)
@@ -0,0 +1,21 @@
+local keep = {}
+local n = 0
+local i = 0
+while i < 300000 do
+    local t = {}
+    t.x = i
+    t.y = {}
+    t.y.v = i * 2
+    if i % 1000 == 0 then
+        keep[n] = t
+        n = n + 1
+    end
+    i = i + 1
+end
+local sum = 0
+local j = 0
+while j < n do
+    sum = sum + keep[j].y.v
+    j = j + 1
+end
+print(sum)
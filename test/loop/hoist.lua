@@ -0,0 +1,14 @@
+local function point(x, y)
+    local p = {}
+    p.x = x
+    p.y = y
+    return p
+end
+local p = point(3, 4)
+local sum = 0
+local i = 0
+while i < 10000000 do
+    sum = sum + p.x * p.y
+    i = i + 1
+end
+print(sum)
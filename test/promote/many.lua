@@ -0,0 +1,22 @@
+local a = 1
+local b = 1
+local c = 1
+local d = 1
+local e = 1
+local f = 1
+local i = 0
+while i < 70 do
+    a = a + a
+    b = b * 2
+    c = c + c + 1
+    d = d * 3
+    e = e - e - e
+    f = f + 1
+    i = i + 1
+end
+print(a)
+print(b)
+print(c)
+print(d)
+print(e)
+print(f)
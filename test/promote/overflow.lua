@@ -0,0 +1,21 @@
+local x = 1
+local i = 0
+while i < 40 do
+    x = x + x
+    i = i + 1
+end
+print(x)
+local y = 0 - x
+local j = 0
+while j < 30 do
+    y = y * 4
+    j = j + 1
+end
+print(y)
+local z = 0
+local k = 0
+while k < 100000 do
+    z = z - 65536
+    k = k + 1
+end
+print(z)
@@ -30,6 +30,7 @@ enum {
     // tables
     VM_AST_FORM_NEW,
     VM_AST_FORM_LOAD,
+    VM_AST_FORM_LEN,
     // math
     VM_AST_FORM_ADD,
     VM_AST_FORM_SUB,
@@ -86,6 +86,9 @@ vm_ast_node_t vm_ast_build_new(void) {
 vm_ast_node_t vm_ast_build_load(vm_ast_node_t table, vm_ast_node_t key) {
     return vm_ast_form(VM_AST_FORM_LOAD, table, key);
 }
+vm_ast_node_t vm_ast_build_len(vm_ast_node_t table) {
+    return vm_ast_form(VM_AST_FORM_LEN, table);
+}
 
 // math
 vm_ast_node_t vm_ast_build_add(vm_ast_node_t lhs, vm_ast_node_t rhs) {
@@ -16,6 +16,7 @@ vm_ast_node_t vm_ast_build_env(void);
 // tables
 vm_ast_node_t vm_ast_build_new(void);
 vm_ast_node_t vm_ast_build_load(vm_ast_node_t table, vm_ast_node_t key);
+vm_ast_node_t vm_ast_build_len(vm_ast_node_t table);
 
 // math
 vm_ast_node_t vm_ast_build_add(vm_ast_node_t lhs, vm_ast_node_t rhs);
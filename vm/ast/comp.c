@@ -15,6 +15,7 @@ struct vm_ast_comp_names_t;
 typedef struct vm_ast_comp_names_t vm_ast_comp_names_t;
 
 struct vm_ast_comp_t {
+    vm_config_t *config;
     vm_ast_blocks_t blocks;
     vm_block_t *cur;
     vm_ast_comp_names_t *names;
@@ -57,8 +58,6 @@ static vm_ast_comp_names_t *vm_ast_comp_names_pop(vm_ast_comp_t *comp) {
 static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node);
 static void vm_ast_comp_br(vm_ast_comp_t *comp, vm_ast_node_t node, vm_block_t *iftrue, vm_block_t *iffalse);
 
-void vm_std_vm_closure(vm_std_value_t *args);
-
 static vm_arg_t *vm_ast_args(size_t nargs, ...) {
     va_list ap;
     va_start(ap, nargs);
@@ -138,7 +137,7 @@ static vm_arg_t vm_ast_comp_names_get_nonlocal(vm_ast_comp_t *comp, vm_ast_comp_
                 .type = VM_ARG_LIT,
                 .lit = (vm_std_value_t){
                     .tag = VM_TAG_I32,
-                    .value = cap.slot,
+                    .value.i32 = (int32_t)cap.slot,
                 }
             };
             vm_ast_blocks_branch(
@@ -174,7 +173,7 @@ static vm_arg_t vm_ast_comp_names_get_nonlocal(vm_ast_comp_t *comp, vm_ast_comp_
         .type = VM_ARG_LIT,
         .lit = (vm_std_value_t){
             .tag = VM_TAG_I32,
-            .value = slotnum + 1,
+            .value.i32 = (int32_t)(slotnum + 1),
         }
     };
     vm_ast_blocks_branch(
@@ -423,6 +422,20 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
                     comp->cur = next;
                     return out;
                 }
+                case VM_AST_FORM_LEN: {
+                    vm_arg_t table = vm_ast_comp_to(comp, form.args[0]);
+                    vm_arg_t out = vm_ast_comp_reg(comp);
+                    vm_ast_blocks_instr(
+                        comp,
+                        (vm_instr_t){
+                            .op = VM_IOP_LEN,
+                            .tag = vm_config_num_tag(comp->config),
+                            .out = out,
+                            .args = vm_ast_args(1, table),
+                        }
+                    );
+                    return out;
+                }
                 case VM_AST_FORM_CALL: {
                     vm_arg_t func = vm_ast_comp_to(comp, form.args[0]);
                     vm_arg_t *args = vm_malloc(sizeof(vm_arg_t) * (form.len + 1));
@@ -588,7 +601,6 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
                     vm_arg_t out = vm_ast_comp_reg(comp);
                     // vm_block_t *with_vm = vm_ast_comp_new_block(comp);
                     // vm_block_t *with_closure = vm_ast_comp_new_block(comp);
-                    vm_block_t *with_lambda = vm_ast_comp_new_block(comp);
 
                     // vm_ast_blocks_instr(
                     //     comp,
@@ -639,15 +651,8 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
 
                     // comp->cur = with_closure;
 
-                    vm_arg_t *call_args = vm_malloc(sizeof(vm_arg_t) * (names->caps.len + 3));
-                    call_args[0] = (vm_arg_t){
-                        .type = VM_ARG_LIT,
-                        .lit = (vm_std_value_t){
-                            .tag = VM_TAG_FFI,
-                            .value.ffi = &vm_std_vm_closure,
-                        },
-                    };
-                    call_args[1] = (vm_arg_t){
+                    vm_arg_t *closure_args = vm_malloc(sizeof(vm_arg_t) * (names->caps.len + 2));
+                    closure_args[0] = (vm_arg_t){
                         .type = VM_ARG_FUN,
                         .func = body,
                     };
@@ -655,27 +660,24 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
                         vm_ast_comp_cap_t cap = names->caps.ptr[i];
                         vm_arg_t got = vm_ast_comp_get_var(comp, cap.name);
                         if (got.type != VM_ARG_NONE) {
-                            call_args[i + 2] = got;
+                            closure_args[i + 1] = got;
                         } else {
-                            call_args[i + 2] = vm_arg_nil();
+                            closure_args[i + 1] = vm_arg_nil();
                         }
                     }
-                    call_args[names->caps.len + 2] = (vm_arg_t){
+                    closure_args[names->caps.len + 1] = (vm_arg_t){
                         .type = VM_ARG_NONE,
                     };
 
-                    vm_ast_blocks_branch(
+                    vm_ast_blocks_instr(
                         comp,
-                        (vm_branch_t){
-                            .op = VM_BOP_CALL,
+                        (vm_instr_t){
+                            .op = VM_IOP_CLOSURE,
                             .out = out,
-                            .args = call_args,
-                            .targets[0] = with_lambda,
+                            .args = closure_args,
                         }
                     );
 
-                    comp->cur = with_lambda;
-
                     return out;
                 }
                 case VM_AST_FORM_WHILE: {
@@ -726,6 +728,7 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
             if (num.tag == VM_TAG_NIL) {
                 return vm_arg_nil();
             } else if (num.tag == VM_TAG_STR) {
+                num.value.str = vm_string_intern(num.value.str, strlen(num.value.str));
                 vm_arg_t str = (vm_arg_t){
                     .type = VM_ARG_LIT,
                     .lit = num,
@@ -766,7 +769,7 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
                 .type = VM_ARG_LIT,
                 .lit = (vm_std_value_t){
                     .tag = VM_TAG_STR,
-                    .value.str = lit,
+                    .value.str = vm_string_intern(lit, strlen(lit)),
                 },
             };
             vm_arg_t out = vm_ast_comp_reg(comp);
@@ -788,8 +791,9 @@ static vm_arg_t vm_ast_comp_to(vm_ast_comp_t *comp, vm_ast_node_t node) {
     exit(1);
 }
 
-vm_ast_blocks_t vm_ast_comp(vm_ast_node_t node) {
+vm_ast_blocks_t vm_ast_comp(vm_config_t *config, vm_ast_node_t node) {
     vm_ast_comp_t comp = (vm_ast_comp_t){
+        .config = config,
         .blocks = (vm_ast_blocks_t){
             .len = 0,
             .blocks = NULL,
@@ -807,5 +811,6 @@ vm_ast_blocks_t vm_ast_comp(vm_ast_node_t node) {
         }
     }
     vm_block_info(comp.blocks.len, comp.blocks.blocks);
+    vm_block_opt(comp.blocks.len, comp.blocks.blocks);
     return comp.blocks;
 }
@@ -14,6 +14,6 @@ struct vm_ast_blocks_t {
     size_t alloc;
 };
 
-vm_ast_blocks_t vm_ast_comp(vm_ast_node_t node);
+vm_ast_blocks_t vm_ast_comp(vm_config_t *config, vm_ast_node_t node);
 
 #endif
@@ -0,0 +1,577 @@
+
+#include "./int.h"
+
+#include "../type.h"
+
+static void vm_int_error(const char *str) {
+    fprintf(stderr, "error: %s\n", str);
+    exit(1);
+}
+
+void vm_int_init(vm_int_state_t *state, vm_config_t *config, size_t nblocks, vm_block_t **blocks, vm_table_t *std) {
+    size_t nregs = 1;
+    for (size_t i = 0; i < nblocks; i++) {
+        if (blocks[i]->nregs > nregs) {
+            nregs = blocks[i]->nregs;
+        }
+    }
+    size_t *counts = vm_malloc(sizeof(size_t) * (nblocks + 1));
+    memset(counts, 0, sizeof(size_t) * (nblocks + 1));
+    *state = (vm_int_state_t){
+        .config = config,
+        .nblocks = nblocks,
+        .blocks = blocks,
+        .std = std,
+        .nregs = nregs,
+        .counts = counts,
+    };
+}
+
+static vm_std_value_t vm_int_read(vm_std_value_t *regs, vm_arg_t arg) {
+    switch (arg.type) {
+        case VM_ARG_LIT: {
+            return arg.lit;
+        }
+        case VM_ARG_REG: {
+            return regs[arg.reg];
+        }
+        case VM_ARG_FUN: {
+            return (vm_std_value_t){
+                .tag = VM_TAG_FUN,
+                .value.i32 = (int32_t)arg.func->id,
+            };
+        }
+        default: {
+            return (vm_std_value_t){
+                .tag = VM_TAG_NIL,
+            };
+        }
+    }
+}
+
+static bool vm_int_is_int(vm_tag_t tag) {
+    return tag == VM_TAG_I8 || tag == VM_TAG_I16 || tag == VM_TAG_I32 || tag == VM_TAG_I64;
+}
+
+static int64_t vm_int_to_i64(vm_std_value_t value) {
+    switch (value.tag) {
+        case VM_TAG_I8: {
+            return value.value.i8;
+        }
+        case VM_TAG_I16: {
+            return value.value.i16;
+        }
+        case VM_TAG_I32: {
+            return value.value.i32;
+        }
+        case VM_TAG_I64: {
+            return value.value.i64;
+        }
+        case VM_TAG_F32: {
+            return (int64_t)value.value.f32;
+        }
+        case VM_TAG_F64: {
+            return (int64_t)value.value.f64;
+        }
+        default: {
+            vm_int_error("expected a number");
+            return 0;
+        }
+    }
+}
+
+static double vm_int_to_f64(vm_std_value_t value) {
+    switch (value.tag) {
+        case VM_TAG_F32: {
+            return value.value.f32;
+        }
+        case VM_TAG_F64: {
+            return value.value.f64;
+        }
+        default: {
+            return (double)vm_int_to_i64(value);
+        }
+    }
+}
+
+// same rounding as the jit: truncate the quotient when it fits the int type
+static double vm_int_fmod(double lhs, double rhs, double min, double max) {
+    double div = lhs / rhs;
+    if (div < min || div > max) {
+        return lhs - div * rhs;
+    }
+    return lhs - (double)(int64_t)div * rhs;
+}
+
+#define VM_INT_ARITH_INT(TYPE_, FIELD_)                                                   \
+    switch (op) {                                                                         \
+        case VM_IOP_ADD: {                                                                \
+            ret.value.FIELD_ = (TYPE_)((uint64_t)lhs.value.FIELD_ + (uint64_t)rhs.value.FIELD_); \
+            break;                                                                        \
+        }                                                                                 \
+        case VM_IOP_SUB: {                                                                \
+            ret.value.FIELD_ = (TYPE_)((uint64_t)lhs.value.FIELD_ - (uint64_t)rhs.value.FIELD_); \
+            break;                                                                        \
+        }                                                                                 \
+        case VM_IOP_MUL: {                                                                \
+            ret.value.FIELD_ = (TYPE_)((uint64_t)lhs.value.FIELD_ * (uint64_t)rhs.value.FIELD_); \
+            break;                                                                        \
+        }                                                                                 \
+        case VM_IOP_DIV: {                                                                \
+            if (rhs.value.FIELD_ == 0) {                                                  \
+                vm_int_error("divide by zero");                                           \
+            }                                                                             \
+            ret.value.FIELD_ = (TYPE_)(lhs.value.FIELD_ / rhs.value.FIELD_);              \
+            break;                                                                        \
+        }                                                                                 \
+        case VM_IOP_MOD: {                                                                \
+            if (rhs.value.FIELD_ == 0) {                                                  \
+                vm_int_error("divide by zero");                                           \
+            }                                                                             \
+            ret.value.FIELD_ = (TYPE_)(lhs.value.FIELD_ % rhs.value.FIELD_);              \
+            break;                                                                        \
+        }                                                                                 \
+    }
+
+static vm_std_value_t vm_int_cast(vm_std_value_t value, vm_tag_t tag) {
+    vm_std_value_t ret = (vm_std_value_t){
+        .tag = tag,
+    };
+    switch (tag) {
+        case VM_TAG_I8: {
+            ret.value.i8 = (int8_t)vm_int_to_i64(value);
+            break;
+        }
+        case VM_TAG_I16: {
+            ret.value.i16 = (int16_t)vm_int_to_i64(value);
+            break;
+        }
+        case VM_TAG_I32: {
+            ret.value.i32 = (int32_t)vm_int_to_i64(value);
+            break;
+        }
+        case VM_TAG_I64: {
+            ret.value.i64 = vm_int_to_i64(value);
+            break;
+        }
+        case VM_TAG_F32: {
+            ret.value.f32 = (float)vm_int_to_f64(value);
+            break;
+        }
+        default: {
+            ret.value.f64 = vm_int_to_f64(value);
+            break;
+        }
+    }
+    return ret;
+}
+
+static bool vm_int_overflows(uint8_t op, vm_std_value_t lhs, vm_std_value_t rhs) {
+    int64_t a = vm_int_to_i64(lhs);
+    int64_t b = vm_int_to_i64(rhs);
+    int64_t res;
+    switch (op) {
+        case VM_IOP_ADD: {
+            if (__builtin_add_overflow(a, b, &res)) {
+                return true;
+            }
+            break;
+        }
+        case VM_IOP_SUB: {
+            if (__builtin_sub_overflow(a, b, &res)) {
+                return true;
+            }
+            break;
+        }
+        case VM_IOP_MUL: {
+            if (__builtin_mul_overflow(a, b, &res)) {
+                return true;
+            }
+            break;
+        }
+        default: {
+            return false;
+        }
+    }
+    switch (lhs.tag) {
+        case VM_TAG_I8: {
+            return res < INT8_MIN || res > INT8_MAX;
+        }
+        case VM_TAG_I16: {
+            return res < INT16_MIN || res > INT16_MAX;
+        }
+        case VM_TAG_I32: {
+            return res < INT32_MIN || res > INT32_MAX;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+// with promote an int ADD, SUB or MUL that overflows is done again as i64, or
+// as f64 when it already was i64, the same as the side exits of the jit
+static vm_std_value_t vm_int_arith(uint8_t op, vm_std_value_t lhs, vm_std_value_t rhs, bool promote) {
+    if (lhs.tag != rhs.tag) {
+        vm_tag_t tag = vm_rblock_type_join(lhs.tag, rhs.tag);
+        if (tag == VM_TAG_UNK) {
+            vm_int_error("math on mismatched types");
+        }
+        lhs = vm_int_cast(lhs, tag);
+        rhs = vm_int_cast(rhs, tag);
+    }
+    if (promote && vm_int_is_int(lhs.tag) && vm_int_overflows(op, lhs, rhs)) {
+        vm_tag_t tag = lhs.tag == VM_TAG_I64 ? VM_TAG_F64 : VM_TAG_I64;
+        lhs = vm_int_cast(lhs, tag);
+        rhs = vm_int_cast(rhs, tag);
+    }
+    vm_std_value_t ret = (vm_std_value_t){
+        .tag = lhs.tag,
+    };
+    switch (lhs.tag) {
+        case VM_TAG_I8: {
+            VM_INT_ARITH_INT(int8_t, i8);
+            break;
+        }
+        case VM_TAG_I16: {
+            VM_INT_ARITH_INT(int16_t, i16);
+            break;
+        }
+        case VM_TAG_I32: {
+            VM_INT_ARITH_INT(int32_t, i32);
+            break;
+        }
+        case VM_TAG_I64: {
+            VM_INT_ARITH_INT(int64_t, i64);
+            break;
+        }
+        case VM_TAG_F32: {
+            float a = lhs.value.f32;
+            float b = rhs.value.f32;
+            switch (op) {
+                case VM_IOP_ADD: {
+                    ret.value.f32 = a + b;
+                    break;
+                }
+                case VM_IOP_SUB: {
+                    ret.value.f32 = a - b;
+                    break;
+                }
+                case VM_IOP_MUL: {
+                    ret.value.f32 = a * b;
+                    break;
+                }
+                case VM_IOP_DIV: {
+                    ret.value.f32 = a / b;
+                    break;
+                }
+                case VM_IOP_MOD: {
+                    ret.value.f32 = (float)vm_int_fmod(a, b, (double)INT32_MIN, (double)INT32_MAX);
+                    break;
+                }
+            }
+            break;
+        }
+        case VM_TAG_F64: {
+            double a = lhs.value.f64;
+            double b = rhs.value.f64;
+            switch (op) {
+                case VM_IOP_ADD: {
+                    ret.value.f64 = a + b;
+                    break;
+                }
+                case VM_IOP_SUB: {
+                    ret.value.f64 = a - b;
+                    break;
+                }
+                case VM_IOP_MUL: {
+                    ret.value.f64 = a * b;
+                    break;
+                }
+                case VM_IOP_DIV: {
+                    ret.value.f64 = a / b;
+                    break;
+                }
+                case VM_IOP_MOD: {
+                    ret.value.f64 = vm_int_fmod(a, b, (double)INT64_MIN, (double)INT64_MAX);
+                    break;
+                }
+            }
+            break;
+        }
+        default: {
+            vm_int_error("math on a non-number");
+        }
+    }
+    return ret;
+}
+
+static vm_std_value_t vm_int_from_len(vm_tag_t tag, uint32_t len) {
+    vm_std_value_t ret = (vm_std_value_t){
+        .tag = tag,
+    };
+    switch (tag) {
+        case VM_TAG_I8: {
+            ret.value.i8 = (int8_t)len;
+            break;
+        }
+        case VM_TAG_I16: {
+            ret.value.i16 = (int16_t)len;
+            break;
+        }
+        case VM_TAG_I32: {
+            ret.value.i32 = (int32_t)len;
+            break;
+        }
+        case VM_TAG_I64: {
+            ret.value.i64 = (int64_t)len;
+            break;
+        }
+        case VM_TAG_F32: {
+            ret.value.f32 = (float)len;
+            break;
+        }
+        default: {
+            ret.tag = VM_TAG_F64;
+            ret.value.f64 = (double)len;
+            break;
+        }
+    }
+    return ret;
+}
+
+static bool vm_int_lt(vm_std_value_t lhs, vm_std_value_t rhs) {
+    if (vm_int_is_int(lhs.tag) && vm_int_is_int(rhs.tag)) {
+        return vm_int_to_i64(lhs) < vm_int_to_i64(rhs);
+    }
+    return vm_int_to_f64(lhs) < vm_int_to_f64(rhs);
+}
+
+static vm_std_value_t vm_int_call(vm_int_state_t *state, vm_std_value_t *regs, vm_branch_t *branch) {
+    vm_arg_t *args = branch->args;
+    vm_std_value_t func = vm_int_read(regs, args[0]);
+    size_t nargs = 0;
+    for (size_t i = 1; args[i].type != VM_ARG_NONE; i++) {
+        nargs += 1;
+    }
+    switch (func.tag) {
+        case VM_TAG_FFI: {
+            // on the stack so the collector finds what the callee stores
+            // in it while it is the only place that holds it
+            vm_std_value_t ffi_args[nargs + 1];
+            for (size_t i = 0; i < nargs; i++) {
+                ffi_args[i] = vm_int_read(regs, args[i + 1]);
+            }
+            ffi_args[nargs] = (vm_std_value_t){
+                .tag = VM_TAG_UNK,
+            };
+            func.value.ffi(ffi_args);
+            return ffi_args[0];
+        }
+        case VM_TAG_FUN:
+        case VM_TAG_CLOSURE: {
+            size_t first = 0;
+            int32_t id = func.value.i32;
+            if (func.tag == VM_TAG_CLOSURE) {
+                first = 1;
+                id = func.value.closure[0].value.i32;
+            }
+            if (id < 0 || (size_t)id >= state->nblocks) {
+                vm_int_error("call of a bad function");
+            }
+            vm_branch_add_callee(branch, id);
+            vm_block_t *block = state->blocks[id];
+            if (func.tag == VM_TAG_FUN && block->nargs != nargs) {
+                vm_int_error("wrong number of args");
+            }
+            // the stack is scanned and a heap buffer is not
+            vm_std_value_t block_args[block->nargs + 1];
+            if (first != 0 && block->nargs != 0) {
+                block_args[0] = func;
+            }
+            for (size_t i = first; i < block->nargs; i++) {
+                if (i - first < nargs) {
+                    block_args[i] = vm_int_read(regs, args[i - first + 1]);
+                } else {
+                    block_args[i] = (vm_std_value_t){
+                        .tag = VM_TAG_NIL,
+                    };
+                }
+            }
+            return vm_int_run(state, block, block_args);
+        }
+        default: {
+            vm_int_error("call of a non-function");
+            return (vm_std_value_t){0};
+        }
+    }
+}
+
+static vm_std_value_t vm_int_get(vm_std_value_t obj, vm_std_value_t key) {
+    switch (obj.tag) {
+        case VM_TAG_TAB: {
+            vm_pair_t pair = (vm_pair_t){
+                .key_val = key.value,
+                .key_tag = key.tag,
+            };
+            vm_table_get_pair(obj.value.table, &pair);
+            return (vm_std_value_t){
+                .tag = pair.val_tag,
+                .value = pair.val_val,
+            };
+        }
+        case VM_TAG_CLOSURE: {
+            return obj.value.closure[vm_int_to_i64(key)];
+        }
+        default: {
+            vm_int_error("cannot index weird thing");
+            return (vm_std_value_t){0};
+        }
+    }
+}
+
+vm_std_value_t vm_int_run(vm_int_state_t *state, vm_block_t *block, vm_std_value_t *args) {
+    vm_std_value_t regs[state->nregs];
+    memset(regs, 0, sizeof(vm_std_value_t) * state->nregs);
+    for (size_t i = 0; i < block->nargs; i++) {
+        regs[block->args[i].reg] = args[i];
+    }
+    while (true) {
+        if (state->hot != NULL && state->counts[block->id]++ >= state->config->hot_runs) {
+            vm_std_value_t block_args[block->nargs + 1];
+            for (size_t i = 0; i < block->nargs; i++) {
+                block_args[i] = regs[block->args[i].reg];
+            }
+            vm_std_value_t ret;
+            if (state->hot(state->hot_data, block, block_args, &ret)) {
+                return ret;
+            }
+            state->counts[block->id] = 0;
+        }
+        for (size_t n = 0; n < block->len; n++) {
+            vm_instr_t instr = block->instrs[n];
+            switch (instr.op) {
+                case VM_IOP_NOP: {
+                    break;
+                }
+                case VM_IOP_MOVE: {
+                    regs[instr.out.reg] = vm_int_read(regs, instr.args[0]);
+                    break;
+                }
+                case VM_IOP_ADD:
+                case VM_IOP_SUB:
+                case VM_IOP_MUL:
+                case VM_IOP_DIV:
+                case VM_IOP_MOD: {
+                    regs[instr.out.reg] = vm_int_arith(instr.op, vm_int_read(regs, instr.args[0]), vm_int_read(regs, instr.args[1]), state->config->use_promote);
+                    break;
+                }
+                case VM_IOP_SET: {
+                    vm_std_value_t table = vm_int_read(regs, instr.args[0]);
+                    if (table.tag != VM_TAG_TAB) {
+                        vm_int_error("cannot set on a non-table");
+                    }
+                    vm_std_value_t key = vm_int_read(regs, instr.args[1]);
+                    vm_std_value_t val = vm_int_read(regs, instr.args[2]);
+                    vm_table_set(table.value.table, key.value, val.value, key.tag, val.tag);
+                    break;
+                }
+                case VM_IOP_NEW: {
+                    regs[instr.out.reg] = (vm_std_value_t){
+                        .tag = VM_TAG_TAB,
+                        .value.table = vm_table_new(),
+                    };
+                    break;
+                }
+                case VM_IOP_LEN: {
+                    vm_std_value_t table = vm_int_read(regs, instr.args[0]);
+                    if (table.tag != VM_TAG_TAB) {
+                        vm_int_error("length of a non-table");
+                    }
+                    vm_tag_t tag = instr.tag == VM_TAG_UNK ? vm_config_num_tag(state->config) : instr.tag;
+                    regs[instr.out.reg] = vm_int_from_len(tag, vm_table_len(table.value.table));
+                    break;
+                }
+                case VM_IOP_STD: {
+                    regs[instr.out.reg] = (vm_std_value_t){
+                        .tag = VM_TAG_TAB,
+                        .value.table = state->std,
+                    };
+                    break;
+                }
+                case VM_IOP_CLOSURE: {
+                    uint32_t nslots = 0;
+                    while (instr.args[nslots].type != VM_ARG_NONE) {
+                        nslots += 1;
+                    }
+                    vm_std_value_t *closure = vm_closure_new(nslots);
+                    for (uint32_t i = 0; i < nslots; i++) {
+                        closure[i] = vm_int_read(regs, instr.args[i]);
+                    }
+                    regs[instr.out.reg] = (vm_std_value_t){
+                        .tag = VM_TAG_CLOSURE,
+                        .value.closure = closure,
+                    };
+                    break;
+                }
+                case VM_IOP_UPVAL: {
+                    vm_std_value_t closure = vm_int_read(regs, instr.args[0]);
+                    regs[instr.out.reg] = closure.value.closure[vm_int_to_i64(vm_int_read(regs, instr.args[1]))];
+                    break;
+                }
+                default: {
+                    vm_print_instr(stderr, instr);
+                    fprintf(stderr, "\n ^ unhandled instruction\n");
+                    exit(1);
+                }
+            }
+        }
+        vm_branch_t branch = block->branch;
+        switch (branch.op) {
+            case VM_BOP_JUMP: {
+                block = branch.targets[0];
+                break;
+            }
+            case VM_BOP_BB: {
+                vm_std_value_t value = vm_int_read(regs, branch.args[0]);
+                bool truthy = value.tag != VM_TAG_NIL && !(value.tag == VM_TAG_BOOL && !value.value.b);
+                block = truthy ? branch.targets[0] : branch.targets[1];
+                break;
+            }
+            case VM_BOP_BEQ: {
+                vm_std_value_t lhs = vm_int_read(regs, branch.args[0]);
+                vm_std_value_t rhs = vm_int_read(regs, branch.args[1]);
+                block = vm_value_eq(lhs, rhs) ? branch.targets[0] : branch.targets[1];
+                break;
+            }
+            case VM_BOP_BLT: {
+                vm_std_value_t lhs = vm_int_read(regs, branch.args[0]);
+                vm_std_value_t rhs = vm_int_read(regs, branch.args[1]);
+                block = vm_int_lt(lhs, rhs) ? branch.targets[0] : branch.targets[1];
+                break;
+            }
+            case VM_BOP_RET: {
+                return vm_int_read(regs, branch.args[0]);
+            }
+            case VM_BOP_GET: {
+                vm_std_value_t obj = vm_int_read(regs, branch.args[0]);
+                vm_std_value_t key = vm_int_read(regs, branch.args[1]);
+                regs[branch.out.reg] = vm_int_get(obj, key);
+                vm_branch_add_seen(&block->branch, regs[branch.out.reg].tag);
+                block = branch.targets[0];
+                break;
+            }
+            case VM_BOP_CALL: {
+                regs[branch.out.reg] = vm_int_call(state, regs, &block->branch);
+                vm_branch_add_seen(&block->branch, regs[branch.out.reg].tag);
+                block = branch.targets[0];
+                break;
+            }
+            default: {
+                vm_print_branch(stderr, branch);
+                fprintf(stderr, "\n ^ unhandled branch\n");
+                exit(1);
+            }
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#if !defined(VM_HEADER_BE_INT)
+#define VM_HEADER_BE_INT
+
+#include "../ir.h"
+#include "../lib.h"
+#include "../obj.h"
+#include "../std/std.h"
+
+struct vm_int_state_t;
+typedef struct vm_int_state_t vm_int_state_t;
+
+// runs unversioned blocks with tags checked at runtime, so it can take any
+// block no matter what types reach it
+struct vm_int_state_t {
+    vm_config_t *config;
+    size_t nblocks;
+    vm_block_t **blocks;
+    vm_table_t *std;
+    // registers in a frame, enough for every block
+    size_t nregs;
+    // times each block was entered, by block id
+    size_t *counts;
+    // called when a block has run config->hot_runs times, returns false if it
+    // cannot take the block, or true with the return of the whole function
+    bool (*hot)(void *hot_data, vm_block_t *block, vm_std_value_t *args, vm_std_value_t *ret);
+    void *hot_data;
+};
+
+void vm_int_init(vm_int_state_t *state, vm_config_t *config, size_t nblocks, vm_block_t **blocks, vm_table_t *std);
+// args are in the order of block->args
+vm_std_value_t vm_int_run(vm_int_state_t *state, vm_block_t *block, vm_std_value_t *args);
+
+#endif
@@ -5,11 +5,20 @@
 #include "../check.h"
 #include "../rblock.h"
 
+// size of each jit code heap, bigger functions get a bigger one
+#define VM_TB_JIT_HEAP (1 << 22)
+
 #define VM_TB_CC TB_CDECL
+
+struct vm_tb_regs_t;
+struct vm_tb_hoist_t;
+typedef struct vm_tb_regs_t vm_tb_regs_t;
+typedef struct vm_tb_hoist_t vm_tb_hoist_t;
+typedef struct vm_tb_loop_t vm_tb_loop_t;
 // #define VM_TB_CC TB_STDCALL
 
 void vm_tb_func_print_value(vm_tb_state_t *mod, TB_Function *fun, vm_tag_t tag, TB_Node *value);
-TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **regs, vm_block_t *block);
+TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **locals, vm_block_t *block);
 void vm_tb_func_report_error(vm_tb_state_t *state, TB_Function *fun, const char *str);
 
 #define vm_tb_select_binary_type(xtag, onint, onfloat, ...) ({ \
@@ -46,6 +55,112 @@ TB_Node *vm_tb_ptr_name(TB_Module *mod, TB_Function *fun, const char *name, void
     return tb_inst_uint(fun, TB_TYPE_PTR, (uint64_t)value);
 }
 
+// bumps the state's nursery inline, only a full chunk calls out, the
+// header goes in with one store since a fresh chunk is zeroed
+static TB_Node *vm_tb_func_alloc(vm_tb_state_t *state, TB_Function *fun, uint32_t size, uint8_t kind) {
+    size_t need = sizeof(vm_gc_header_t) + (((size_t)size + 7) & ~(size_t)7);
+    TB_Node *nursery = vm_tb_ptr_name(state->module, fun, "<nursery>", &state->nursery);
+    TB_Node *out = tb_inst_local(fun, 8, 8);
+    TB_Node *slow = tb_inst_region(fun);
+    TB_Node *after = tb_inst_region(fun);
+    if (need <= VM_NURSERY_CHUNK / 8) {
+        TB_Node *used_ptr = tb_inst_member_access(fun, nursery, offsetof(vm_nursery_t, used));
+        TB_Node *used = tb_inst_load(fun, TB_TYPE_I64, used_ptr, 8, false);
+        TB_Node *next = tb_inst_add(fun, used, tb_inst_uint(fun, TB_TYPE_I64, need), TB_ARITHMATIC_NONE);
+        TB_Node *limit = tb_inst_load(fun, TB_TYPE_I64, tb_inst_member_access(fun, nursery, offsetof(vm_nursery_t, size)), 8, false);
+        TB_Node *fast = tb_inst_region(fun);
+        tb_inst_if(fun, tb_inst_cmp_ilt(fun, limit, next, false), slow, fast);
+        tb_inst_set_control(fun, fast);
+        TB_Node *base = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, nursery, offsetof(vm_nursery_t, base)), 8, false);
+        TB_Node *header = tb_inst_array_access(fun, base, used, 1);
+        tb_inst_store(fun, TB_TYPE_I64, used_ptr, next, 8, false);
+        tb_inst_store(fun, TB_TYPE_I64, header, tb_inst_uint(fun, TB_TYPE_I64, (uint64_t)size | ((uint64_t)kind << 32)), 8, false);
+        tb_inst_store(fun, TB_TYPE_PTR, out, tb_inst_member_access(fun, header, sizeof(vm_gc_header_t)), 8, false);
+        tb_inst_goto(fun, after);
+    } else {
+        tb_inst_goto(fun, slow);
+    }
+    {
+        tb_inst_set_control(fun, slow);
+        TB_PrototypeParam proto_params[3] = {
+            {TB_TYPE_PTR},
+            {TB_TYPE_I32},
+            {TB_TYPE_I8},
+        };
+        TB_PrototypeParam proto_ret[1] = {
+            {TB_TYPE_PTR},
+        };
+        TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 3, proto_params, 1, proto_ret, false);
+        TB_Node *args[3] = {
+            nursery,
+            tb_inst_uint(fun, TB_TYPE_I32, size),
+            tb_inst_uint(fun, TB_TYPE_I8, kind),
+        };
+        TB_Node *got = tb_inst_call(
+                           fun,
+                           proto,
+                           tb_inst_get_symbol_address(fun, state->vm_nursery_alloc),
+                           3,
+                           args
+        )
+                           .single;
+        tb_inst_store(fun, TB_TYPE_PTR, out, got, 8, false);
+        tb_inst_goto(fun, after);
+    }
+    tb_inst_set_control(fun, after);
+    return tb_inst_load(fun, TB_TYPE_PTR, out, 8, false);
+}
+
+// old tables remember stores of young objects, the tag is known here so
+// only stores of tables and closures pay for the check
+static void vm_tb_func_barrier(vm_tb_state_t *state, TB_Function *fun, TB_Node *obj, vm_tag_t tag) {
+    if (vm_mem_gc != VM_USE_LEAKS_TGC || (tag != VM_TAG_TAB && tag != VM_TAG_CLOSURE)) {
+        return;
+    }
+    TB_Node *mark = tb_inst_load(
+        fun,
+        TB_TYPE_I8,
+        tb_inst_member_access(fun, obj, (int64_t)offsetof(vm_gc_header_t, mark) - (int64_t)sizeof(vm_gc_header_t)),
+        1,
+        false
+    );
+    TB_Node *old = tb_inst_region(fun);
+    TB_Node *after = tb_inst_region(fun);
+    tb_inst_if(fun, tb_inst_cmp_ne(fun, mark, tb_inst_uint(fun, TB_TYPE_I8, 0)), old, after);
+    tb_inst_set_control(fun, old);
+    TB_PrototypeParam proto_params[1] = {
+        {TB_TYPE_PTR},
+    };
+    TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 1, proto_params, 0, NULL, false);
+    TB_Node *args[1] = {
+        obj,
+    };
+    tb_inst_call(fun, proto, tb_inst_get_symbol_address(fun, state->vm_gc_remember), 1, args);
+    tb_inst_goto(fun, after);
+    tb_inst_set_control(fun, after);
+}
+
+// emits the shape check of an inline cache, control continues on the hit
+// path and the returned node is the address of the cached slot
+TB_Node *vm_tb_func_slot_guard(TB_Function *fun, TB_Node *table, TB_Node *cache, TB_Node *miss) {
+    TB_Node *hit = tb_inst_region(fun);
+    TB_Node *shape = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, table, offsetof(vm_table_t, shape)), 8, false);
+    TB_Node *cached_shape = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, cache, offsetof(vm_table_cache_t, shape)), 8, false);
+    tb_inst_if(fun, tb_inst_cmp_eq(fun, shape, cached_shape), hit, miss);
+    tb_inst_set_control(fun, hit);
+    TB_Node *slots = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, table, offsetof(vm_table_t, slots)), 8, false);
+    TB_Node *slot = tb_inst_load(fun, TB_TYPE_I32, tb_inst_member_access(fun, cache, offsetof(vm_table_cache_t, slot)), 4, false);
+    return tb_inst_array_access(fun, slots, tb_inst_zxt(fun, slot, TB_TYPE_I64), sizeof(vm_std_value_t));
+}
+
+// the hit path of a shape check done before the loop
+static TB_Node *vm_tb_func_hoisted_guard(TB_Function *fun, TB_Node *slot, TB_Node *miss) {
+    TB_Node *hit = tb_inst_region(fun);
+    tb_inst_if(fun, tb_inst_cmp_ne(fun, slot, tb_inst_uint(fun, TB_TYPE_PTR, 0)), hit, miss);
+    tb_inst_set_control(fun, hit);
+    return slot;
+}
+
 TB_DataType vm_tag_to_tb_type(vm_tag_t tag) {
     switch (tag) {
         case VM_TAG_NIL: {
@@ -95,7 +210,90 @@ TB_DataType vm_tag_to_tb_type(vm_tag_t tag) {
     }
 }
 
-TB_Node *vm_tb_func_read_arg(TB_Function *fun, TB_Node **regs, vm_arg_t arg) {
+// inside one region a register is an SSA value, it only goes through its
+// stack slot in locals when the region is left or read as another type
+struct vm_tb_regs_t {
+    TB_Node **locals;
+    size_t nregs;
+    TB_Node **vals;
+    TB_DataType *types;
+    bool *dirty;
+};
+
+// a GET on a constant string key whose shape check was done once before the
+// loop, slot is the cached slot or NULL when that check missed
+struct vm_tb_hoist_t {
+    vm_block_t *block;
+    vm_table_cache_t *cache;
+    TB_Node *slot;
+};
+
+struct vm_tb_loop_t {
+    vm_block_t *head;
+    // the header after the hoisted code, where back edges go
+    TB_Node *body;
+    size_t nhoists;
+    vm_tb_hoist_t *hoists;
+    vm_tb_loop_t *next;
+};
+
+static bool vm_tb_type_eq(TB_DataType a, TB_DataType b) {
+    return a.type == b.type && a.width == b.width && a.data == b.data;
+}
+
+static void vm_tb_regs_init(vm_tb_regs_t *regs, TB_Node **locals, size_t nregs) {
+    *regs = (vm_tb_regs_t){
+        .locals = locals,
+        .nregs = nregs,
+        .vals = vm_malloc(sizeof(TB_Node *) * (nregs + 1)),
+        .types = vm_malloc(sizeof(TB_DataType) * (nregs + 1)),
+        .dirty = vm_malloc(sizeof(bool) * (nregs + 1)),
+    };
+    for (size_t i = 0; i < nregs; i++) {
+        regs->vals[i] = NULL;
+        regs->dirty[i] = false;
+    }
+}
+
+static void vm_tb_regs_deinit(vm_tb_regs_t *regs) {
+    vm_free(regs->vals);
+    vm_free(regs->types);
+    vm_free(regs->dirty);
+}
+
+static void vm_tb_func_flush_reg(TB_Function *fun, vm_tb_regs_t *regs, size_t reg) {
+    if (regs->dirty[reg]) {
+        tb_inst_store(fun, regs->types[reg], regs->locals[reg], regs->vals[reg], 8, false);
+        regs->dirty[reg] = false;
+    }
+}
+
+// stores every register written in this region, must come before any edge
+// to another region
+void vm_tb_func_flush_regs(TB_Function *fun, vm_tb_regs_t *regs) {
+    for (size_t i = 0; i < regs->nregs; i++) {
+        vm_tb_func_flush_reg(fun, regs, i);
+    }
+}
+
+void vm_tb_func_write_reg(vm_tb_regs_t *regs, size_t reg, TB_DataType type, TB_Node *value) {
+    regs->vals[reg] = value;
+    regs->types[reg] = type;
+    regs->dirty[reg] = true;
+}
+
+TB_Node *vm_tb_func_read_reg(TB_Function *fun, vm_tb_regs_t *regs, size_t reg, TB_DataType type) {
+    if (regs->vals[reg] != NULL && vm_tb_type_eq(regs->types[reg], type)) {
+        return regs->vals[reg];
+    }
+    vm_tb_func_flush_reg(fun, regs, reg);
+    TB_Node *value = tb_inst_load(fun, type, regs->locals[reg], 8, false);
+    regs->vals[reg] = value;
+    regs->types[reg] = type;
+    return value;
+}
+
+TB_Node *vm_tb_func_read_arg(TB_Function *fun, vm_tb_regs_t *regs, vm_arg_t arg) {
     switch (arg.type) {
         case VM_ARG_LIT: {
             switch (arg.lit.tag) {
@@ -121,7 +319,7 @@ TB_Node *vm_tb_func_read_arg(TB_Function *fun, TB_Node **regs, vm_arg_t arg) {
                     return tb_inst_float64(fun, arg.lit.value.f64);
                 }
                 case VM_TAG_STR: {
-                    return tb_inst_string(fun, strlen(arg.lit.value.str) + 1, arg.lit.value.str);
+                    return tb_inst_uint(fun, TB_TYPE_PTR, (uint64_t)arg.lit.value.str);
                 }
                 case VM_TAG_FFI: {
                     return tb_inst_uint(fun, TB_TYPE_PTR, (uint64_t)arg.lit.value.ffi);
@@ -135,13 +333,7 @@ TB_Node *vm_tb_func_read_arg(TB_Function *fun, TB_Node **regs, vm_arg_t arg) {
             return tb_inst_uint(fun, TB_TYPE_PTR, 0);
         }
         case VM_ARG_REG: {
-            return tb_inst_load(
-                fun,
-                vm_tag_to_tb_type(arg.reg_tag),
-                regs[arg.reg],
-                8,
-                false
-            );
+            return vm_tb_func_read_reg(fun, regs, arg.reg, vm_tag_to_tb_type(arg.reg_tag));
         }
         case VM_ARG_FUN: {
             return tb_inst_uint(fun, TB_TYPE_I32, (uint64_t)arg.func->id);
@@ -154,6 +346,111 @@ TB_Node *vm_tb_func_read_arg(TB_Function *fun, TB_Node **regs, vm_arg_t arg) {
     }
 }
 
+// reads a number as the tag the type specializer joined it to, mixed math
+// stays unboxed with the conversion done inline
+TB_Node *vm_tb_func_read_num(TB_Function *fun, vm_tb_regs_t *regs, vm_arg_t arg, vm_tag_t tag) {
+    TB_Node *value = vm_tb_func_read_arg(fun, regs, arg);
+    vm_tag_t from = vm_arg_to_tag(arg);
+    if (from == tag || vm_rblock_type_join(from, tag) == VM_TAG_UNK) {
+        return value;
+    }
+    bool from_float = from == VM_TAG_F32 || from == VM_TAG_F64;
+    bool to_float = tag == VM_TAG_F32 || tag == VM_TAG_F64;
+    if (from_float && to_float) {
+        if (tag == VM_TAG_F64) {
+            return tb_inst_fpxt(fun, value, TB_TYPE_F64);
+        }
+        return tb_inst_trunc(fun, value, TB_TYPE_F32);
+    }
+    if (to_float) {
+        return tb_inst_int2float(fun, value, vm_tag_to_tb_type(tag), true);
+    }
+    if (from_float) {
+        return tb_inst_float2int(fun, value, vm_tag_to_tb_type(tag), true);
+    }
+    if (tag > from) {
+        return tb_inst_sxt(fun, value, vm_tag_to_tb_type(tag));
+    }
+    return tb_inst_trunc(fun, value, vm_tag_to_tb_type(tag));
+}
+
+// all code goes into state->jit, a new heap is only made when it is full
+static void *vm_tb_jit_place(vm_tb_state_t *state, TB_Function *fun, TB_FunctionOutput *out) {
+    size_t size = 0;
+    tb_output_get_code(out, &size);
+    void *ret = NULL;
+    if (state->jit != NULL) {
+        ret = tb_jit_place_function(state->jit, fun);
+    }
+    if (ret == NULL) {
+        size_t capacity = VM_TB_JIT_HEAP;
+        while (capacity < size * 2) {
+            capacity *= 2;
+        }
+        state->jit = tb_jit_begin(state->module, capacity);
+        state->jit_stats.heaps += 1;
+        state->jit_stats.mapped += capacity;
+        ret = tb_jit_place_function(state->jit, fun);
+    }
+    state->jit_stats.funcs += 1;
+    state->jit_stats.used += size;
+    return ret;
+}
+
+// without threads there is no background compiler to keep out
+static void vm_tb_lock(vm_tb_state_t *state) {
+#if defined(VM_TB_USE_THREADS)
+    mtx_lock(&state->lock);
+#else
+    (void)state;
+#endif
+}
+
+static void vm_tb_unlock(vm_tb_state_t *state) {
+#if defined(VM_TB_USE_THREADS)
+    mtx_unlock(&state->lock);
+#else
+    (void)state;
+#endif
+}
+
+// the code of a version as a symbol, so call sites can call it directly. a
+// background compile rebinds it, sites placed before that keep the first code
+static void *vm_tb_rblock_symbol(vm_tb_state_t *state, vm_rblock_t *rblock) {
+    if (rblock->sym == NULL) {
+        char *name = vm_malloc(sizeof(char) * 32);
+        snprintf(name, 32, "<code %p>", (void *)rblock);
+        rblock->sym = tb_extern_create(state->module, -1, name, TB_EXTERNAL_SO_LOCAL);
+        tb_symbol_bind_ptr(rblock->sym, rblock->jit);
+    }
+    return rblock->sym;
+}
+
+// a block that already has max_versions versions gets no more, its new tag
+// combinations run in the interpreter instead
+static bool vm_tb_versions_full(vm_tb_state_t *state, vm_rblock_t *rblock) {
+    size_t max = state->config->max_versions;
+    if (max == 0) {
+        return false;
+    }
+    vm_cache_t *cache = rblock->block->cache;
+    if (vm_cache_get(cache, rblock) != NULL) {
+        return false;
+    }
+    return vm_cache_versions(cache) >= max;
+}
+
+// the version of the continuation for tag, or NULL if there is none and no
+// room left to make one
+static vm_block_t *vm_tb_func_next_version(vm_tb_state_t *state, vm_branch_t *branch, vm_tag_t tag) {
+    vm_rblock_t *rblock = vm_rblock_next(branch, tag);
+    rblock->state = state;
+    if (vm_tb_versions_full(state, rblock)) {
+        return NULL;
+    }
+    return vm_rblock_version(state->nblocks, state->blocks, rblock);
+}
+
 void vm_tb_func_reset_pass(vm_block_t *block) {
     if (block->pass == NULL) {
         return;
@@ -170,14 +467,443 @@ void vm_tb_func_reset_pass(vm_block_t *block) {
             vm_tb_func_reset_pass(block->branch.targets[1]);
             break;
         }
+        case VM_BOP_GET:
+        case VM_BOP_CALL: {
+            for (size_t i = 1; i < VM_TAG_MAX; i++) {
+                vm_rblock_t *rblock = block->branch.rtargets[i];
+                if (rblock == NULL) {
+                    continue;
+                }
+                vm_block_t *next = vm_cache_get(rblock->block->cache, rblock);
+                if (next != NULL) {
+                    vm_tb_func_reset_pass(next);
+                }
+            }
+            break;
+        }
+    }
+}
+
+// with use_region, continuations for the tags seen at this GET or CALL are
+// compiled into this function, most frequent first, instead of going through
+// vm_tb_comp_call. without it a CALL still inlines its most frequent return
+// tag, or the number tag when none was seen. other tags use the trampoline
+void vm_tb_func_inline_seen(vm_tb_state_t *state, TB_Function *fun, vm_tb_regs_t *regs, vm_block_t *block, TB_Node *val_val, TB_Node *val_tag) {
+    vm_branch_t *branch = &block->branch;
+    bool is_call = branch->op == VM_BOP_CALL;
+    if (!state->config->use_region && !is_call) {
+        return;
+    }
+    vm_tag_t order[VM_TAG_MAX];
+    size_t norder = 0;
+    for (size_t i = 1; i < VM_TAG_MAX; i++) {
+        if ((branch->seen & ((uint32_t)1 << i)) == 0 && branch->rtargets[i] == NULL) {
+            continue;
+        }
+        size_t at = norder++;
+        while (at > 0 && branch->hits[order[at - 1]] < branch->hits[i]) {
+            order[at] = order[at - 1];
+            at -= 1;
+        }
+        order[at] = (vm_tag_t)i;
+    }
+    if (norder == 0 && is_call) {
+        order[norder++] = vm_config_num_tag(state->config);
+    }
+    if (!state->config->use_region && norder > 1) {
+        norder = 1;
+    }
+    vm_tb_func_flush_regs(fun, regs);
+    for (size_t i = 0; i < norder; i++) {
+        vm_block_t *next_block = vm_tb_func_next_version(state, branch, order[i]);
+        if (next_block == NULL) {
+            continue;
+        }
+        TB_Node *is_tag = tb_inst_region(fun);
+        TB_Node *not_tag = tb_inst_region(fun);
+        tb_inst_if(
+            fun,
+            tb_inst_cmp_eq(fun, val_tag, tb_inst_uint(fun, TB_TYPE_I32, order[i])),
+            is_tag,
+            not_tag
+        );
+        tb_inst_set_control(fun, is_tag);
+        tb_inst_store(fun, TB_TYPE_PTR, regs->locals[branch->out.reg], val_val, 8, false);
+        tb_inst_goto(fun, vm_tb_func_body_once(state, fun, regs->locals, next_block));
+        tb_inst_set_control(fun, not_tag);
+    }
+}
+
+// continuations copy their args out on entry, so the args live in the
+// frame of the caller unless a tail call has already given that frame up
+static TB_Node *vm_tb_func_cont_args(vm_tb_state_t *state, TB_Function *fun, size_t nargs) {
+    if (nargs == 0) {
+        return vm_tb_ptr_name(state->module, fun, "<data>", 0);
+    }
+    if (!state->config->use_tailcall) {
+        return tb_inst_local(fun, sizeof(vm_value_t) * nargs, 8);
+    }
+    TB_PrototypeParam proto_params[1] = {
+        {TB_TYPE_I64},
+    };
+    TB_PrototypeParam proto_rets[1] = {
+        {TB_TYPE_PTR},
+    };
+    TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 1, proto_params, 1, proto_rets, false);
+    TB_Node *call_args[1] = {
+        tb_inst_uint(fun, TB_TYPE_I64, nargs),
+    };
+    return tb_inst_call(
+               fun,
+               proto,
+               tb_inst_get_symbol_address(fun, state->vm_tb_tail_args),
+               1,
+               call_args
+    )
+        .single;
+}
+
+static TB_Node *vm_tb_func_int_op(TB_Function *fun, uint8_t op, TB_Node *lhs, TB_Node *rhs) {
+    switch (op) {
+        case VM_IOP_ADD: {
+            return tb_inst_add(fun, lhs, rhs, TB_ARITHMATIC_NONE);
+        }
+        case VM_IOP_SUB: {
+            return tb_inst_sub(fun, lhs, rhs, TB_ARITHMATIC_NONE);
+        }
+        default: {
+            return tb_inst_mul(fun, lhs, rhs, TB_ARITHMATIC_NONE);
+        }
+    }
+}
+
+static TB_Node *vm_tb_func_float_op(TB_Function *fun, uint8_t op, TB_Node *lhs, TB_Node *rhs) {
+    switch (op) {
+        case VM_IOP_ADD: {
+            return tb_inst_fadd(fun, lhs, rhs);
+        }
+        case VM_IOP_SUB: {
+            return tb_inst_fsub(fun, lhs, rhs);
+        }
+        default: {
+            return tb_inst_fmul(fun, lhs, rhs);
+        }
+    }
+}
+
+// integer ADD, SUB and MUL of instrs[n] under config->use_promote, an overflow
+// leaves to a version of the rest of the block with the exact result, ints
+// below i64 widen to i64 and i64 to f64, NULL if the op should just wrap. the
+// rest is only versioned and compiled once it overflows, through
+// vm_tb_comp_call like a GET or CALL continuation
+static TB_Node *vm_tb_func_checked_arith(vm_tb_state_t *state, TB_Function *fun, vm_tb_regs_t *regs, vm_block_t *block, size_t n, TB_Node *lhs, TB_Node *rhs) {
+    vm_instr_t instr = block->instrs[n];
+    if (!state->config->use_promote || block->base == NULL) {
+        return NULL;
+    }
+    if (instr.op != VM_IOP_ADD && instr.op != VM_IOP_SUB && instr.op != VM_IOP_MUL) {
+        return NULL;
+    }
+    vm_tag_t wide_tag = instr.tag == VM_TAG_I64 ? VM_TAG_F64 : VM_TAG_I64;
+    vm_rblock_t *tail = vm_rblock_tail(block, n, wide_tag);
+    TB_Node *value;
+    TB_Node *wide = NULL;
+    TB_Node *is_over;
+    if (instr.tag != VM_TAG_I64) {
+        wide = vm_tb_func_int_op(fun, instr.op, tb_inst_sxt(fun, lhs, TB_TYPE_I64), tb_inst_sxt(fun, rhs, TB_TYPE_I64));
+        value = tb_inst_trunc(fun, wide, vm_tag_to_tb_type(instr.tag));
+        is_over = tb_inst_cmp_ne(fun, tb_inst_sxt(fun, value, TB_TYPE_I64), wide);
+    } else {
+        value = vm_tb_func_int_op(fun, instr.op, lhs, rhs);
+        TB_Node *zero = tb_inst_sint(fun, TB_TYPE_I64, 0);
+        switch (instr.op) {
+            case VM_IOP_ADD: {
+                is_over = tb_inst_cmp_ilt(fun, tb_inst_and(fun, tb_inst_xor(fun, lhs, value), tb_inst_xor(fun, rhs, value)), zero, true);
+                break;
+            }
+            case VM_IOP_SUB: {
+                is_over = tb_inst_cmp_ilt(fun, tb_inst_and(fun, tb_inst_xor(fun, lhs, rhs), tb_inst_xor(fun, lhs, value)), zero, true);
+                break;
+            }
+            default: {
+                // the product is exact if dividing by lhs gives back rhs, -1
+                // is checked on its own since INT64_MIN / -1 traps
+                TB_Node *neg_one = tb_inst_sint(fun, TB_TYPE_I64, -1);
+                TB_Node *is_zero = tb_inst_cmp_eq(fun, lhs, zero);
+                TB_Node *is_neg_one = tb_inst_cmp_eq(fun, lhs, neg_one);
+                TB_Node *divisor = tb_inst_select(fun, tb_inst_or(fun, is_zero, is_neg_one), tb_inst_sint(fun, TB_TYPE_I64, 1), lhs);
+                is_over = tb_inst_select(
+                    fun,
+                    is_zero,
+                    tb_inst_bool(fun, false),
+                    tb_inst_select(
+                        fun,
+                        is_neg_one,
+                        tb_inst_cmp_eq(fun, rhs, tb_inst_sint(fun, TB_TYPE_I64, INT64_MIN)),
+                        tb_inst_cmp_ne(fun, tb_inst_div(fun, value, divisor, true), rhs)
+                    )
+                );
+                break;
+            }
+        }
+    }
+    TB_Node *over = tb_inst_region(fun);
+    TB_Node *fits = tb_inst_region(fun);
+    tb_inst_if(fun, is_over, over, fits);
+    tb_inst_set_control(fun, over);
+    if (wide == NULL) {
+        wide = vm_tb_func_float_op(
+            fun,
+            instr.op,
+            tb_inst_int2float(fun, lhs, TB_TYPE_F64, true),
+            tb_inst_int2float(fun, rhs, TB_TYPE_F64, true)
+        );
+    }
+    vm_tb_comp_state_t *comp = vm_malloc(sizeof(vm_tb_comp_state_t));
+    *comp = (vm_tb_comp_state_t){
+        .func = &vm_tb_comp_call,
+        .rblock = tail,
+        .state = state,
+    };
+    vm_block_t *rest = tail->block;
+    TB_Node *args_local = vm_tb_func_cont_args(state, fun, rest->nargs);
+    // regs is left as it is, the path that fits keeps using it
+    for (size_t i = 0; i < rest->nargs; i++) {
+        size_t reg = rest->args[i].reg;
+        TB_DataType type = vm_tag_to_tb_type(tail->regs->tags[reg]);
+        TB_Node *arg;
+        if (reg == instr.out.reg) {
+            arg = wide;
+        } else if (regs->vals[reg] != NULL) {
+            arg = regs->vals[reg];
+            type = regs->types[reg];
+        } else {
+            arg = tb_inst_load(fun, type, regs->locals[reg], 8, false);
+        }
+        tb_inst_store(fun, type, tb_inst_member_access(fun, args_local, i * 8), arg, 1, false);
+    }
+    TB_PrototypeParam proto_params[2] = {
+        {TB_TYPE_PTR},
+        {TB_TYPE_PTR},
+    };
+    TB_PrototypeParam proto_rets[2] = {
+        {TB_TYPE_PTR},
+        {TB_TYPE_I32},
+    };
+    TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 2, proto_params, 2, proto_rets, false);
+    TB_Node *comp_ptr = vm_tb_ptr_name(state->module, fun, "<data>", comp);
+    TB_Node *call_args[2] = {
+        comp_ptr,
+        args_local,
+    };
+    TB_Node *comp_func = tb_inst_load(
+        fun,
+        TB_TYPE_PTR,
+        tb_inst_member_access(fun, comp_ptr, offsetof(vm_tb_comp_state_t, func)),
+        1,
+        false
+    );
+    if (state->config->use_tailcall) {
+        tb_inst_tailcall(fun, proto, comp_func, 2, call_args);
+    } else {
+        tb_inst_ret(fun, 2, tb_inst_call(fun, proto, comp_func, 2, call_args).multiple);
+    }
+    tb_inst_set_control(fun, fits);
+    return value;
+}
+
+// marks with pass every version a compile from block can reach, making the
+// continuations vm_tb_func_inline_seen will take so loops through them are
+// found, vm_tb_func_reset_pass clears the marks
+static void vm_tb_func_version_seen(vm_tb_state_t *state, vm_block_t *block) {
+    if (block->pass != NULL) {
+        return;
+    }
+    block->pass = block;
+    switch (block->branch.op) {
+        case VM_BOP_JUMP: {
+            vm_tb_func_version_seen(state, block->branch.targets[0]);
+            break;
+        }
+        case VM_BOP_BLT:
+        case VM_BOP_BEQ: {
+            vm_tb_func_version_seen(state, block->branch.targets[0]);
+            vm_tb_func_version_seen(state, block->branch.targets[1]);
+            break;
+        }
+        case VM_BOP_GET:
+        case VM_BOP_CALL: {
+            if (!state->config->use_region) {
+                break;
+            }
+            for (size_t i = 1; i < VM_TAG_MAX; i++) {
+                if ((block->branch.seen & ((uint32_t)1 << i)) == 0 && block->branch.rtargets[i] == NULL) {
+                    continue;
+                }
+                vm_block_t *next = vm_tb_func_next_version(state, &block->branch, (vm_tag_t)i);
+                if (next != NULL) {
+                    vm_tb_func_version_seen(state, next);
+                }
+            }
+            break;
+        }
+    }
+}
+
+static vm_tb_hoist_t *vm_tb_func_find_hoist(vm_tb_state_t *state, vm_block_t *block) {
+    for (vm_tb_loop_t *loop = state->loops; loop != NULL; loop = loop->next) {
+        for (size_t i = 0; i < loop->nhoists; i++) {
+            if (loop->hoists[i].block == block) {
+                return &loop->hoists[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// called with control at the start of the header, if the loop has no SET or
+// CALL then no table changes shape in it, so the shape checks of GETs on
+// tables the loop does not write are done here once
+static vm_tb_loop_t *vm_tb_func_loop_enter(vm_tb_state_t *state, TB_Function *fun, TB_Node **locals, vm_block_t *head, vm_tb_loop_t *loop) {
+    if (!state->config->use_loop || !head->isloop || head->isirr || head->tags == NULL) {
+        return NULL;
+    }
+    size_t nblocks = 1;
+    size_t alloc = 16;
+    vm_block_t **blocks = vm_malloc(sizeof(vm_block_t *) * alloc);
+    blocks[0] = head;
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *succs[VM_TAG_MAX];
+        size_t nsuccs = vm_block_succs(blocks[i], succs);
+        for (size_t j = 0; j < nsuccs; j++) {
+            if (!vm_block_in_loop(succs[j], head)) {
+                continue;
+            }
+            bool found = false;
+            for (size_t k = 0; k < nblocks; k++) {
+                if (blocks[k] == succs[j]) {
+                    found = true;
+                    break;
+                }
+            }
+            if (found) {
+                continue;
+            }
+            if (nblocks + 1 >= alloc) {
+                alloc = (nblocks + 1) * 2;
+                blocks = vm_realloc(blocks, sizeof(vm_block_t *) * alloc);
+            }
+            blocks[nblocks++] = succs[j];
+        }
+    }
+    bool *written = vm_malloc(sizeof(bool) * (head->nregs + 1));
+    memset(written, 0, sizeof(bool) * (head->nregs + 1));
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->branch.op == VM_BOP_CALL || block->nregs > head->nregs) {
+            goto none;
+        }
+        for (size_t j = 0; j < block->len; j++) {
+            if (block->instrs[j].op == VM_IOP_SET) {
+                goto none;
+            }
+            if (block->instrs[j].out.type == VM_ARG_REG) {
+                written[block->instrs[j].out.reg] = true;
+            }
+        }
+        if (block->branch.out.type == VM_ARG_REG) {
+            written[block->branch.out.reg] = true;
+        }
+    }
+    *loop = (vm_tb_loop_t){
+        .head = head,
+        .hoists = vm_malloc(sizeof(vm_tb_hoist_t) * nblocks),
+        .next = state->loops,
+    };
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_branch_t *branch = &blocks[i]->branch;
+        if (branch->op != VM_BOP_GET) {
+            continue;
+        }
+        if (branch->args[0].type != VM_ARG_REG || branch->args[1].type != VM_ARG_LIT || branch->args[1].lit.tag != VM_TAG_STR) {
+            continue;
+        }
+        size_t reg = branch->args[0].reg;
+        if (written[reg] || head->tags->tags[reg] != VM_TAG_TAB) {
+            continue;
+        }
+        vm_table_cache_t *cache = vm_table_cache_new();
+        TB_Node *table = tb_inst_load(fun, TB_TYPE_PTR, locals[reg], 8, false);
+        TB_Node *cache_ptr = vm_tb_ptr_name(state->module, fun, "<cache>", cache);
+        TB_Node *shape = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, table, offsetof(vm_table_t, shape)), 8, false);
+        // the cache is fresh, so fill it here on a miss rather than leave
+        // the whole loop on the slow path
+        {
+            TB_Node *cached_shape = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, cache_ptr, offsetof(vm_table_cache_t, shape)), 8, false);
+            TB_Node *fill = tb_inst_region(fun);
+            TB_Node *filled = tb_inst_region(fun);
+            tb_inst_if(fun, tb_inst_cmp_eq(fun, shape, cached_shape), filled, fill);
+            tb_inst_set_control(fun, fill);
+            TB_PrototypeParam fill_params[3] = {
+                {TB_TYPE_PTR},
+                {TB_TYPE_PTR},
+                {TB_TYPE_PTR},
+            };
+            TB_FunctionPrototype *fill_proto = tb_prototype_create(state->module, VM_TB_CC, 3, fill_params, 0, NULL, false);
+            TB_Node *fill_args[3] = {
+                table,
+                vm_tb_ptr_name(state->module, fun, "<key>", (void *)branch->args[1].lit.value.str),
+                cache_ptr,
+            };
+            tb_inst_call(fun, fill_proto, tb_inst_get_symbol_address(fun, state->vm_table_cache_fill), 3, fill_args);
+            tb_inst_goto(fun, filled);
+            tb_inst_set_control(fun, filled);
+        }
+        TB_Node *cached_shape = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, cache_ptr, offsetof(vm_table_cache_t, shape)), 8, false);
+        TB_Node *slots = tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, table, offsetof(vm_table_t, slots)), 8, false);
+        TB_Node *slot = tb_inst_load(fun, TB_TYPE_I32, tb_inst_member_access(fun, cache_ptr, offsetof(vm_table_cache_t, slot)), 4, false);
+        loop->hoists[loop->nhoists++] = (vm_tb_hoist_t){
+            .block = blocks[i],
+            .cache = cache,
+            .slot = tb_inst_select(
+                fun,
+                tb_inst_cmp_eq(fun, shape, cached_shape),
+                tb_inst_array_access(fun, slots, tb_inst_zxt(fun, slot, TB_TYPE_I64), sizeof(vm_std_value_t)),
+                tb_inst_uint(fun, TB_TYPE_PTR, 0)
+            ),
+        };
+    }
+    vm_free(blocks);
+    vm_free(written);
+    if (loop->nhoists == 0) {
+        vm_free(loop->hoists);
+        return NULL;
     }
+    loop->body = tb_inst_region(fun);
+    tb_inst_goto(fun, loop->body);
+    tb_inst_set_control(fun, loop->body);
+    state->loops = loop;
+    return loop;
+none:
+    vm_free(blocks);
+    vm_free(written);
+    return NULL;
 }
 
-TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **regs, vm_block_t *block) {
+TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **locals, vm_block_t *block) {
+    for (vm_tb_loop_t *loop = state->loops; loop != NULL; loop = loop->next) {
+        if (loop->head == block) {
+            return loop->body;
+        }
+    }
     if (block->pass != NULL) {
         return block->pass;
     }
 
+    vm_tb_regs_t regs_buf;
+    vm_tb_regs_t *regs = &regs_buf;
+    vm_tb_regs_init(regs, locals, block->nregs);
+
     TB_Node *old_ctrl = tb_inst_get_control(fun);
 
     TB_Node *ret = tb_inst_region(fun);
@@ -186,6 +912,9 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
 
     block->pass = ret;
 
+    vm_tb_loop_t loop_buf;
+    vm_tb_loop_t *loop = vm_tb_func_loop_enter(state, fun, locals, block, &loop_buf);
+
 #if VM_USE_DUMP
     if (state->config->dump_ver) {
         fprintf(stdout, "\n--- vmir ---\n");
@@ -197,14 +926,7 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
         vm_instr_t instr = block->instrs[n];
         switch (instr.op) {
             case VM_IOP_MOVE: {
-                tb_inst_store(
-                    fun,
-                    vm_tag_to_tb_type(instr.tag),
-                    regs[instr.out.reg],
-                    vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                    8,
-                    false
-                );
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), vm_tb_func_read_arg(fun, regs, instr.args[0]));
                 break;
             }
             case VM_IOP_ADD: {
@@ -212,25 +934,18 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 if (instr.tag == VM_TAG_F32 || instr.tag == VM_TAG_F64) {
                     value = tb_inst_fadd(
                         fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1])
+                        vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag),
+                        vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag)
                     );
                 } else {
-                    value = tb_inst_add(
-                        fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1]),
-                        TB_ARITHMATIC_NONE
-                    );
+                    TB_Node *lhs = vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag);
+                    TB_Node *rhs = vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag);
+                    value = vm_tb_func_checked_arith(state, fun, regs, block, n, lhs, rhs);
+                    if (value == NULL) {
+                        value = tb_inst_add(fun, lhs, rhs, TB_ARITHMATIC_NONE);
+                    }
                 }
-                tb_inst_store(
-                    fun,
-                    vm_tag_to_tb_type(instr.tag),
-                    regs[instr.out.reg],
-                    value,
-                    8,
-                    false
-                );
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), value);
                 break;
             }
             case VM_IOP_SUB: {
@@ -238,25 +953,18 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 if (instr.tag == VM_TAG_F32 || instr.tag == VM_TAG_F64) {
                     value = tb_inst_fsub(
                         fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1])
+                        vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag),
+                        vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag)
                     );
                 } else {
-                    value = tb_inst_sub(
-                        fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1]),
-                        TB_ARITHMATIC_NONE
-                    );
+                    TB_Node *lhs = vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag);
+                    TB_Node *rhs = vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag);
+                    value = vm_tb_func_checked_arith(state, fun, regs, block, n, lhs, rhs);
+                    if (value == NULL) {
+                        value = tb_inst_sub(fun, lhs, rhs, TB_ARITHMATIC_NONE);
+                    }
                 }
-                tb_inst_store(
-                    fun,
-                    vm_tag_to_tb_type(instr.tag),
-                    regs[instr.out.reg],
-                    value,
-                    8,
-                    false
-                );
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), value);
                 break;
             }
             case VM_IOP_MUL: {
@@ -264,25 +972,18 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 if (instr.tag == VM_TAG_F32 || instr.tag == VM_TAG_F64) {
                     value = tb_inst_fmul(
                         fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1])
+                        vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag),
+                        vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag)
                     );
                 } else {
-                    value = tb_inst_mul(
-                        fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1]),
-                        TB_ARITHMATIC_NONE
-                    );
+                    TB_Node *lhs = vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag);
+                    TB_Node *rhs = vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag);
+                    value = vm_tb_func_checked_arith(state, fun, regs, block, n, lhs, rhs);
+                    if (value == NULL) {
+                        value = tb_inst_mul(fun, lhs, rhs, TB_ARITHMATIC_NONE);
+                    }
                 }
-                tb_inst_store(
-                    fun,
-                    vm_tag_to_tb_type(instr.tag),
-                    regs[instr.out.reg],
-                    value,
-                    8,
-                    false
-                );
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), value);
                 break;
             }
             case VM_IOP_DIV: {
@@ -290,25 +991,18 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 if (instr.tag == VM_TAG_F32 || instr.tag == VM_TAG_F64) {
                     value = tb_inst_fdiv(
                         fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1])
+                        vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag),
+                        vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag)
                     );
                 } else {
                     value = tb_inst_div(
                         fun,
-                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                        vm_tb_func_read_arg(fun, regs, instr.args[1]),
+                        vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag),
+                        vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag),
                         true
                     );
                 }
-                tb_inst_store(
-                    fun,
-                    vm_tag_to_tb_type(instr.tag),
-                    regs[instr.out.reg],
-                    value,
-                    8,
-                    false
-                );
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), value);
                 break;
             }
             case VM_IOP_MOD: {
@@ -316,92 +1010,68 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                     TB_Node *bad = tb_inst_region(fun);
                     TB_Node *good = tb_inst_region(fun);
                     TB_Node *after = tb_inst_region(fun);
-                    TB_Node *lhs = vm_tb_func_read_arg(fun, regs, instr.args[0]);
-                    TB_Node *rhs = vm_tb_func_read_arg(fun, regs, instr.args[1]);
+                    TB_Node *lhs = vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag);
+                    TB_Node *rhs = vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag);
                     TB_Node *raw_div = tb_inst_fdiv(fun, lhs, rhs);
                     TB_Node *too_low = tb_inst_cmp_flt(fun, raw_div, tb_inst_float64(fun, (double)INT64_MIN));
                     TB_Node *too_high = tb_inst_cmp_fgt(fun, raw_div, tb_inst_float64(fun, (double)INT64_MAX));
                     TB_Node *is_bad = tb_inst_or(fun, too_low, too_high);
                     tb_inst_if(fun, is_bad, bad, good);
+                    TB_Node *good_sub;
+                    TB_Node *bad_sub;
                     {
                         tb_inst_set_control(fun, good);
                         TB_Node *int_div = tb_inst_float2int(fun, raw_div, TB_TYPE_I64, true);
                         TB_Node *float_div = tb_inst_int2float(fun, int_div, TB_TYPE_F64, true);
                         TB_Node *mul = tb_inst_fmul(fun, float_div, rhs);
-                        TB_Node *sub = tb_inst_fsub(fun, lhs, mul);
-                        tb_inst_store(
-                            fun,
-                            vm_tag_to_tb_type(instr.tag),
-                            regs[instr.out.reg],
-                            sub, 8, false
-                        );
+                        good_sub = tb_inst_fsub(fun, lhs, mul);
                         tb_inst_goto(fun, after);
                     }
                     {
                         tb_inst_set_control(fun, bad);
                         TB_Node *mul = tb_inst_fmul(fun, raw_div, rhs);
-                        TB_Node *sub = tb_inst_fsub(fun, lhs, mul);
-                        tb_inst_store(
-                            fun,
-                            vm_tag_to_tb_type(instr.tag),
-                            regs[instr.out.reg],
-                            sub, 8, false
-                        );
+                        bad_sub = tb_inst_fsub(fun, lhs, mul);
                         tb_inst_goto(fun, after);
                     }
                     tb_inst_set_control(fun, after);
+                    vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), tb_inst_phi2(fun, after, good_sub, bad_sub));
                 } else if (instr.tag == VM_TAG_F32) {
                     TB_Node *bad = tb_inst_region(fun);
                     TB_Node *good = tb_inst_region(fun);
                     TB_Node *after = tb_inst_region(fun);
-                    TB_Node *lhs = vm_tb_func_read_arg(fun, regs, instr.args[0]);
-                    TB_Node *rhs = vm_tb_func_read_arg(fun, regs, instr.args[1]);
+                    TB_Node *lhs = vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag);
+                    TB_Node *rhs = vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag);
                     TB_Node *raw_div = tb_inst_fdiv(fun, lhs, rhs);
                     TB_Node *too_low = tb_inst_cmp_flt(fun, raw_div, tb_inst_float32(fun, (float)INT32_MIN));
                     TB_Node *too_high = tb_inst_cmp_fgt(fun, raw_div, tb_inst_float32(fun, (float)INT32_MAX));
                     TB_Node *is_bad = tb_inst_or(fun, too_low, too_high);
                     tb_inst_if(fun, is_bad, bad, good);
+                    TB_Node *good_sub;
+                    TB_Node *bad_sub;
                     {
                         tb_inst_set_control(fun, good);
                         TB_Node *int_div = tb_inst_float2int(fun, raw_div, TB_TYPE_I32, true);
                         TB_Node *float_div = tb_inst_int2float(fun, int_div, TB_TYPE_F32, true);
                         TB_Node *mul = tb_inst_fmul(fun, float_div, rhs);
-                        TB_Node *sub = tb_inst_fsub(fun, lhs, mul);
-                        tb_inst_store(
-                            fun,
-                            vm_tag_to_tb_type(instr.tag),
-                            regs[instr.out.reg],
-                            sub, 8, false
-                        );
+                        good_sub = tb_inst_fsub(fun, lhs, mul);
                         tb_inst_goto(fun, after);
                     }
                     {
                         tb_inst_set_control(fun, bad);
                         TB_Node *mul = tb_inst_fmul(fun, raw_div, rhs);
-                        TB_Node *sub = tb_inst_fsub(fun, lhs, mul);
-                        tb_inst_store(
-                            fun,
-                            vm_tag_to_tb_type(instr.tag),
-                            regs[instr.out.reg],
-                            sub, 8, false
-                        );
+                        bad_sub = tb_inst_fsub(fun, lhs, mul);
                         tb_inst_goto(fun, after);
                     }
                     tb_inst_set_control(fun, after);
+                    vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), tb_inst_phi2(fun, after, good_sub, bad_sub));
                 } else {
-                    tb_inst_store(
+                    TB_Node *value = tb_inst_mod(
                         fun,
-                        vm_tag_to_tb_type(instr.tag),
-                        regs[instr.out.reg],
-                        tb_inst_mod(
-                            fun,
-                            vm_tb_func_read_arg(fun, regs, instr.args[0]),
-                            vm_tb_func_read_arg(fun, regs, instr.args[1]),
-                            true
-                        ),
-                        8,
-                        false
+                        vm_tb_func_read_num(fun, regs, instr.args[0], instr.tag),
+                        vm_tb_func_read_num(fun, regs, instr.args[1], instr.tag),
+                        true
                     );
+                    vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), value);
                 }
                 break;
             }
@@ -409,19 +1079,73 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 break;
             }
             case VM_IOP_STD: {
-                tb_inst_store(
-                    fun,
-                    TB_TYPE_PTR,
-                    regs[instr.out.reg],
-                    vm_tb_ptr_name(state->module, fun, "<data>", state->std),
-                    8,
-                    false
-                );
+                vm_tb_func_write_reg(regs, instr.out.reg, TB_TYPE_PTR, vm_tb_ptr_name(state->module, fun, "<data>", state->std));
                 break;
             }
             case VM_IOP_SET: {
                 vm_tag_t key_tag = vm_arg_to_tag(instr.args[1]);
                 vm_tag_t val_tag = vm_arg_to_tag(instr.args[2]);
+                if (instr.args[1].type == VM_ARG_LIT && key_tag == VM_TAG_STR) {
+                    // constant string key: guarded store through a per site inline cache
+                    vm_table_cache_t *cache = vm_table_cache_new();
+                    TB_Node *table = vm_tb_func_read_arg(fun, regs, instr.args[0]);
+                    TB_Node *key = vm_tb_func_read_arg(fun, regs, instr.args[1]);
+                    TB_Node *val = vm_tb_func_read_arg(fun, regs, instr.args[2]);
+                    TB_Node *cache_ptr = vm_tb_ptr_name(state->module, fun, "<cache>", cache);
+                    TB_Node *miss = tb_inst_region(fun);
+                    TB_Node *after = tb_inst_region(fun);
+                    {
+                        TB_Node *slot = vm_tb_func_slot_guard(fun, table, cache_ptr, miss);
+                        vm_tb_func_barrier(state, fun, table, val_tag);
+                        tb_inst_store(
+                            fun,
+                            vm_tag_to_tb_type(val_tag),
+                            tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, value)),
+                            val,
+                            8,
+                            false
+                        );
+                        tb_inst_store(
+                            fun,
+                            TB_TYPE_I32,
+                            tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, tag)),
+                            tb_inst_uint(fun, TB_TYPE_I32, val_tag),
+                            4,
+                            false
+                        );
+                        tb_inst_goto(fun, after);
+                    }
+                    {
+                        tb_inst_set_control(fun, miss);
+                        TB_PrototypeParam cached_params[6] = {
+                            {TB_TYPE_PTR},
+                            {TB_TYPE_PTR},
+                            {vm_tag_to_tb_type(val_tag)},
+                            {TB_TYPE_I32},
+                            {TB_TYPE_I32},
+                            {TB_TYPE_PTR},
+                        };
+                        TB_FunctionPrototype *cached_proto = tb_prototype_create(state->module, VM_TB_CC, 6, cached_params, 0, NULL, false);
+                        TB_Node *cached_args[6] = {
+                            table,
+                            key,
+                            val,
+                            tb_inst_uint(fun, TB_TYPE_I32, key_tag),
+                            tb_inst_uint(fun, TB_TYPE_I32, val_tag),
+                            cache_ptr,
+                        };
+                        tb_inst_call(
+                            fun,
+                            cached_proto,
+                            tb_inst_get_symbol_address(fun, state->vm_table_set_cached),
+                            6,
+                            cached_args
+                        );
+                        tb_inst_goto(fun, after);
+                    }
+                    tb_inst_set_control(fun, after);
+                    break;
+                }
                 TB_PrototypeParam proto_params[5] = {
                     {TB_TYPE_PTR},
                     {vm_tag_to_tb_type(key_tag)},
@@ -447,25 +1171,104 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 break;
             }
             case VM_IOP_NEW: {
-                TB_PrototypeParam proto_ret[1] = {
-                    {TB_TYPE_PTR},
-                };
-                TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 0, NULL, 1, proto_ret, false);
+                // nursery chunks are zeroed, so only the shape needs a store
+                TB_Node *table = vm_tb_func_alloc(state, fun, sizeof(vm_table_t), VM_GC_KIND_TABLE);
                 tb_inst_store(
                     fun,
                     TB_TYPE_PTR,
-                    regs[instr.out.reg],
-                    tb_inst_call(
+                    tb_inst_member_access(fun, table, offsetof(vm_table_t, shape)),
+                    vm_tb_ptr_name(state->module, fun, "<shape>", vm_shape_root()),
+                    8,
+                    false
+                );
+                vm_tb_func_write_reg(regs, instr.out.reg, TB_TYPE_PTR, table);
+                break;
+            }
+            case VM_IOP_CLOSURE: {
+                // every slot tag is known here, so filling it in is plain stores
+                uint32_t nslots = 0;
+                while (instr.args[nslots].type != VM_ARG_NONE) {
+                    nslots += 1;
+                }
+                TB_Node *closure = vm_tb_func_alloc(state, fun, (uint32_t)(sizeof(vm_std_value_t) * nslots), VM_GC_KIND_CLOSURE);
+                for (uint32_t i = 0; i < nslots; i++) {
+                    vm_tag_t tag = vm_arg_to_tag(instr.args[i]);
+                    TB_Node *slot = tb_inst_member_access(fun, closure, (int64_t)(sizeof(vm_std_value_t) * i));
+                    if (tag != VM_TAG_NIL) {
+                        tb_inst_store(
+                            fun,
+                            vm_tag_to_tb_type(tag),
+                            tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, value)),
+                            vm_tb_func_read_arg(fun, regs, instr.args[i]),
+                            8,
+                            false
+                        );
+                    }
+                    tb_inst_store(
                         fun,
-                        proto,
-                        tb_inst_get_symbol_address(fun, state->vm_table_new),
-                        0,
-                        NULL
-                    )
-                        .single,
+                        TB_TYPE_I32,
+                        tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, tag)),
+                        tb_inst_uint(fun, TB_TYPE_I32, tag),
+                        4,
+                        false
+                    );
+                }
+                vm_tb_func_write_reg(regs, instr.out.reg, TB_TYPE_PTR, closure);
+                break;
+            }
+            case VM_IOP_UPVAL: {
+                TB_Node *slot = tb_inst_array_access(
+                    fun,
+                    vm_tb_func_read_arg(fun, regs, instr.args[0]),
+                    vm_tb_func_read_arg(fun, regs, instr.args[1]),
+                    sizeof(vm_std_value_t)
+                );
+                TB_Node *value = tb_inst_load(
+                    fun,
+                    vm_tag_to_tb_type(instr.tag),
+                    tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, value)),
                     8,
                     false
                 );
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), value);
+                break;
+            }
+            case VM_IOP_LEN: {
+                // the border is kept up to date by vm_table_set, so this is a single load
+                TB_Node *len = tb_inst_load(
+                    fun,
+                    TB_TYPE_I32,
+                    tb_inst_member_access(
+                        fun,
+                        vm_tb_func_read_arg(fun, regs, instr.args[0]),
+                        offsetof(vm_table_t, len)
+                    ),
+                    4,
+                    false
+                );
+                switch (instr.tag) {
+                    case VM_TAG_I8:
+                    case VM_TAG_I16: {
+                        len = tb_inst_trunc(fun, len, vm_tag_to_tb_type(instr.tag));
+                        break;
+                    }
+                    case VM_TAG_I32: {
+                        break;
+                    }
+                    case VM_TAG_I64: {
+                        len = tb_inst_zxt(fun, len, TB_TYPE_I64);
+                        break;
+                    }
+                    case VM_TAG_F32:
+                    case VM_TAG_F64: {
+                        len = tb_inst_int2float(fun, len, vm_tag_to_tb_type(instr.tag), false);
+                        break;
+                    }
+                    default: {
+                        __builtin_trap();
+                    }
+                }
+                vm_tb_func_write_reg(regs, instr.out.reg, vm_tag_to_tb_type(instr.tag), len);
                 break;
             }
             default: {
@@ -478,11 +1281,21 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
 
     vm_branch_t branch = block->branch;
 
+    switch (branch.op) {
+        case VM_BOP_JUMP:
+        case VM_BOP_BB:
+        case VM_BOP_BLT:
+        case VM_BOP_BEQ: {
+            vm_tb_func_flush_regs(fun, regs);
+            break;
+        }
+    }
+
     switch (branch.op) {
         case VM_BOP_JUMP: {
             tb_inst_goto(
                 fun,
-                vm_tb_func_body_once(state, fun, regs, branch.targets[0])
+                vm_tb_func_body_once(state, fun, regs->locals, branch.targets[0])
             );
             break;
         }
@@ -494,11 +1307,11 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                     branch.tag,
                     tb_inst_cmp_ilt, tb_inst_cmp_flt,
                     fun,
-                    vm_tb_func_read_arg(fun, regs, branch.args[0]),
-                    vm_tb_func_read_arg(fun, regs, branch.args[1])
+                    vm_tb_func_read_num(fun, regs, branch.args[0], branch.tag),
+                    vm_tb_func_read_num(fun, regs, branch.args[1], branch.tag)
                 ),
-                vm_tb_func_body_once(state, fun, regs, branch.targets[0]),
-                vm_tb_func_body_once(state, fun, regs, branch.targets[1])
+                vm_tb_func_body_once(state, fun, regs->locals, branch.targets[0]),
+                vm_tb_func_body_once(state, fun, regs->locals, branch.targets[1])
             );
             break;
         }
@@ -508,11 +1321,11 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 fun,
                 tb_inst_cmp_eq(
                     fun,
-                    vm_tb_func_read_arg(fun, regs, branch.args[0]),
-                    vm_tb_func_read_arg(fun, regs, branch.args[1])
+                    vm_tb_func_read_num(fun, regs, branch.args[0], branch.tag),
+                    vm_tb_func_read_num(fun, regs, branch.args[1], branch.tag)
                 ),
-                vm_tb_func_body_once(state, fun, regs, branch.targets[0]),
-                vm_tb_func_body_once(state, fun, regs, branch.targets[1])
+                vm_tb_func_body_once(state, fun, regs->locals, branch.targets[0]),
+                vm_tb_func_body_once(state, fun, regs->locals, branch.targets[1])
             );
             break;
         }
@@ -676,6 +1489,55 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
 
                 TB_FunctionPrototype *call_proto = tb_prototype_create(state->module, VM_TB_CC, nargs, call_proto_params, 2, call_proto_rets, false);
 
+                if (branch.ncallees <= VM_BRANCH_CALLEES) {
+                    for (size_t i = 0; i < branch.ncallees; i++) {
+                        vm_rblock_t *callee = vm_rblock_call_target(state->blocks, &block->branch, (size_t)branch.callees[i]);
+                        if (callee == NULL || callee->jit == NULL) {
+                            continue;
+                        }
+                        TB_Node *is_callee = tb_inst_region(fun);
+                        TB_Node *not_callee = tb_inst_region(fun);
+                        tb_inst_if(
+                            fun,
+                            tb_inst_cmp_eq(fun, block_num, tb_inst_uint(fun, TB_TYPE_I32, (uint64_t)branch.callees[i])),
+                            is_callee,
+                            not_callee
+                        );
+
+                        tb_inst_set_control(fun, is_callee);
+
+                        TB_Node **got = tb_inst_call(
+                                            fun,
+                                            call_proto,
+                                            tb_inst_get_symbol_address(fun, vm_tb_rblock_symbol(state, callee)),
+                                            nargs,
+                                            call_args
+                        )
+                                            .multiple;
+
+                        tb_inst_store(
+                            fun,
+                            TB_TYPE_PTR,
+                            val_val,
+                            got[0],
+                            8,
+                            false
+                        );
+                        tb_inst_store(
+                            fun,
+                            TB_TYPE_I32,
+                            val_tag,
+                            got[1],
+                            4,
+                            false
+                        );
+
+                        tb_inst_goto(fun, after);
+
+                        tb_inst_set_control(fun, not_callee);
+                    }
+                }
+
                 tb_inst_if(
                     fun,
                     tb_inst_cmp_eq(fun, global, tb_inst_uint(fun, TB_TYPE_PTR, 0)),
@@ -686,17 +1548,10 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 {
                     tb_inst_set_control(fun, no_cache);
 
-                    TB_Node *rblock_call_table = vm_tb_ptr_name(state->module, fun, "<call_table>", branch.call_table);
-                    // tb_inst_debugbreak(fun);
-                    TB_Node *rblock_ref = tb_inst_array_access(
-                        fun,
-                        rblock_call_table,
-                        block_num,
-                        sizeof(vm_rblock_t *)
-                    );
-                    TB_Node *rblock = tb_inst_load(fun, TB_TYPE_PTR, rblock_ref, 1, false);
-
-                    TB_PrototypeParam comp_args[2] = {
+                    TB_PrototypeParam comp_args[4] = {
+                        {TB_TYPE_PTR},
+                        {TB_TYPE_PTR},
+                        {TB_TYPE_I32},
                         {TB_TYPE_PTR},
                     };
 
@@ -704,37 +1559,25 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                         {TB_TYPE_PTR},
                     };
 
-                    TB_FunctionPrototype *comp_proto = tb_prototype_create(state->module, VM_TB_CC, 1, comp_args, 1, comp_ret, false);
+                    TB_FunctionPrototype *comp_proto = tb_prototype_create(state->module, VM_TB_CC, 4, comp_args, 1, comp_ret, false);
 
-                    TB_Node *comp_params[1];
-
-                    comp_params[0] = vm_tb_ptr_name(state->module, fun, "<data>", rblock);
-                    for (size_t i = 0; i < state->nblocks; i++) {
-                        vm_rblock_t *rblock = branch.call_table[i];
-                        if (rblock == NULL) {
-                            continue;
-                        }
-                        rblock->state = state;
-                    }
+                    // vm_tb_call_comp fills in the cache slot itself
+                    TB_Node *comp_params[4] = {
+                        vm_tb_ptr_name(state->module, fun, "<state>", state),
+                        vm_tb_ptr_name(state->module, fun, "<branch>", &block->branch),
+                        block_num,
+                        global_ptr,
+                    };
 
                     TB_Node *call_func = tb_inst_call(
                                              fun,
                                              comp_proto,
-                                             tb_inst_get_symbol_address(fun, state->vm_tb_rfunc_comp),
-                                             1,
-                                             &rblock
+                                             tb_inst_get_symbol_address(fun, state->vm_tb_call_comp),
+                                             4,
+                                             comp_params
                     )
                                              .single;
 
-                    tb_inst_store(
-                        fun,
-                        TB_TYPE_PTR,
-                        global_ptr,
-                        call_func,
-                        1,
-                        false
-                    );
-
                     TB_Node **got = tb_inst_call(
                                         fun,
                                         call_proto,
@@ -834,12 +1677,18 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
 
             TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 2, proto_params, 2, proto_rets, false);
 
+            vm_tb_func_inline_seen(state, fun, regs, block, val_val, val_tag);
+
             vm_tb_comp_state_t *value_state = vm_malloc(sizeof(vm_tb_comp_state_t) * VM_TAG_MAX);
 
             for (size_t i = 1; i < VM_TAG_MAX; i++) {
-                value_state[i].func = &vm_tb_comp_call;
-                branch.rtargets[i]->state = state;
-                value_state[i].rblock = branch.rtargets[i];
+                value_state[i] = (vm_tb_comp_state_t){
+                    .func = &vm_tb_comp_call,
+                    .rblock = NULL,
+                    .branch = &block->branch,
+                    .tag = (vm_tag_t)i,
+                    .state = state,
+                };
             }
 
             TB_Node *ptr_state = tb_inst_array_access(
@@ -849,13 +1698,7 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 sizeof(vm_tb_comp_state_t)
             );
 
-            TB_Node *args_local;
-            if (branch.targets[0]->nargs == 0) {
-                args_local = vm_tb_ptr_name(state->module, fun, "<data>", 0);
-            } else {
-                void *args = vm_malloc(sizeof(vm_value_t) * branch.targets[0]->nargs);
-                args_local = tb_inst_uint(fun, TB_TYPE_PTR, (uint64_t)args);
-            }
+            TB_Node *args_local = vm_tb_func_cont_args(state, fun, branch.targets[0]->nargs);
 
             TB_Node *call_args[2];
 
@@ -951,23 +1794,81 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                     tb_inst_member_access(
                         fun,
                         arg2,
-                        offsetof(vm_pair_t, key_tag)
-                    ),
-                    tb_inst_uint(fun, TB_TYPE_I32, tag),
-                    4,
-                    false
-                );
-                TB_Node *get_args[2] = {
-                    vm_tb_func_read_arg(fun, regs, branch.args[0]),
-                    arg2,
-                };
-                tb_inst_call(
-                    fun,
-                    get_proto,
-                    tb_inst_get_symbol_address(fun, state->vm_table_get_pair),
-                    2,
-                    get_args
-                );
+                        offsetof(vm_pair_t, key_tag)
+                    ),
+                    tb_inst_uint(fun, TB_TYPE_I32, tag),
+                    4,
+                    false
+                );
+                if (branch.args[1].type == VM_ARG_LIT && tag == VM_TAG_STR) {
+                    // constant string key: guarded load through a per site inline cache
+                    vm_tb_hoist_t *hoist = vm_tb_func_find_hoist(state, block);
+                    vm_table_cache_t *cache = hoist != NULL ? hoist->cache : vm_table_cache_new();
+                    TB_Node *table = vm_tb_func_read_arg(fun, regs, branch.args[0]);
+                    TB_Node *cache_ptr = vm_tb_ptr_name(state->module, fun, "<cache>", cache);
+                    TB_Node *miss = tb_inst_region(fun);
+                    TB_Node *after = tb_inst_region(fun);
+                    {
+                        TB_Node *slot;
+                        if (hoist != NULL) {
+                            slot = vm_tb_func_hoisted_guard(fun, hoist->slot, miss);
+                        } else {
+                            slot = vm_tb_func_slot_guard(fun, table, cache_ptr, miss);
+                        }
+                        tb_inst_store(
+                            fun,
+                            TB_TYPE_I32,
+                            tb_inst_member_access(fun, arg2, offsetof(vm_pair_t, val_tag)),
+                            tb_inst_load(fun, TB_TYPE_I32, tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, tag)), 4, false),
+                            4,
+                            false
+                        );
+                        tb_inst_store(
+                            fun,
+                            TB_TYPE_PTR,
+                            tb_inst_member_access(fun, arg2, offsetof(vm_pair_t, val_val)),
+                            tb_inst_load(fun, TB_TYPE_PTR, tb_inst_member_access(fun, slot, offsetof(vm_std_value_t, value)), 8, false),
+                            8,
+                            false
+                        );
+                        tb_inst_goto(fun, after);
+                    }
+                    {
+                        tb_inst_set_control(fun, miss);
+                        TB_PrototypeParam cached_params[3] = {
+                            {TB_TYPE_PTR},
+                            {TB_TYPE_PTR},
+                            {TB_TYPE_PTR},
+                        };
+                        TB_FunctionPrototype *cached_proto = tb_prototype_create(state->module, VM_TB_CC, 3, cached_params, 0, NULL, false);
+                        TB_Node *cached_args[3] = {
+                            table,
+                            arg2,
+                            cache_ptr,
+                        };
+                        tb_inst_call(
+                            fun,
+                            cached_proto,
+                            tb_inst_get_symbol_address(fun, state->vm_table_get_cached),
+                            3,
+                            cached_args
+                        );
+                        tb_inst_goto(fun, after);
+                    }
+                    tb_inst_set_control(fun, after);
+                } else {
+                    TB_Node *get_args[2] = {
+                        vm_tb_func_read_arg(fun, regs, branch.args[0]),
+                        arg2,
+                    };
+                    tb_inst_call(
+                        fun,
+                        get_proto,
+                        tb_inst_get_symbol_address(fun, state->vm_table_get_pair),
+                        2,
+                        get_args
+                    );
+                }
 
                 val_tag = tb_inst_load(
                     fun,
@@ -1040,6 +1941,8 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
 
             TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 2, proto_params, 2, proto_rets, false);
 
+            vm_tb_func_inline_seen(state, fun, regs, block, val_val, val_tag);
+
             vm_tb_comp_state_t *value_state = vm_malloc(sizeof(vm_tb_comp_state_t) * VM_TAG_MAX);
 
             // for (size_t i = 1; i < VM_TAG_MAX; i++) {
@@ -1054,9 +1957,13 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
             // }
 
             for (size_t i = 1; i < VM_TAG_MAX; i++) {
-                value_state[i].func = &vm_tb_comp_call;
-                branch.rtargets[i]->state = state;
-                value_state[i].rblock = branch.rtargets[i];
+                value_state[i] = (vm_tb_comp_state_t){
+                    .func = &vm_tb_comp_call,
+                    .rblock = NULL,
+                    .branch = &block->branch,
+                    .tag = (vm_tag_t)i,
+                    .state = state,
+                };
             }
 
             TB_Node *ptr_state = tb_inst_array_access(
@@ -1066,13 +1973,7 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
                 sizeof(vm_tb_comp_state_t)
             );
 
-            TB_Node *args_local;
-            if (branch.targets[0]->nargs == 0) {
-                args_local = vm_tb_ptr_name(state->module, fun, "<data>", 0);
-            } else {
-                void *args = vm_malloc(sizeof(vm_value_t) * branch.targets[0]->nargs);
-                args_local = tb_inst_uint(fun, TB_TYPE_PTR, (uint64_t)args);
-            }
+            TB_Node *args_local = vm_tb_func_cont_args(state, fun, branch.targets[0]->nargs);
 
             TB_Node *call_args[2];
 
@@ -1147,6 +2048,12 @@ TB_Node *vm_tb_func_body_once(vm_tb_state_t *state, TB_Function *fun, TB_Node **
 
     tb_inst_set_control(fun, old_ctrl);
 
+    vm_tb_regs_deinit(regs);
+
+    if (loop != NULL) {
+        state->loops = loop->next;
+    }
+
     return ret;
 }
 
@@ -1277,59 +2184,84 @@ void vm_tb_new_module(vm_tb_state_t *state) {
 
     state->module = mod;
 
-    state->vm_tb_rfunc_comp = tb_extern_create(mod, -1, "vm_tb_rfunc_comp", TB_EXTERNAL_SO_LOCAL);
-    state->vm_table_new = tb_extern_create(mod, -1, "vm_table_new", TB_EXTERNAL_SO_LOCAL);
+    state->vm_tb_call_comp = tb_extern_create(mod, -1, "vm_tb_call_comp", TB_EXTERNAL_SO_LOCAL);
+    state->vm_tb_int_call = tb_extern_create(mod, -1, "vm_tb_int_call", TB_EXTERNAL_SO_LOCAL);
+    state->vm_tb_tail_args = tb_extern_create(mod, -1, "vm_tb_tail_args", TB_EXTERNAL_SO_LOCAL);
+    state->vm_nursery_alloc = tb_extern_create(mod, -1, "vm_nursery_alloc", TB_EXTERNAL_SO_LOCAL);
+    state->vm_gc_remember = tb_extern_create(mod, -1, "vm_gc_remember", TB_EXTERNAL_SO_LOCAL);
     state->vm_table_set = tb_extern_create(mod, -1, "vm_table_set", TB_EXTERNAL_SO_LOCAL);
     state->vm_table_get_pair = tb_extern_create(mod, -1, "vm_table_get_pair", TB_EXTERNAL_SO_LOCAL);
+    state->vm_table_get_cached = tb_extern_create(mod, -1, "vm_table_get_cached", TB_EXTERNAL_SO_LOCAL);
+    state->vm_table_cache_fill = tb_extern_create(mod, -1, "vm_table_cache_fill", TB_EXTERNAL_SO_LOCAL);
+    state->vm_table_set_cached = tb_extern_create(mod, -1, "vm_table_set_cached", TB_EXTERNAL_SO_LOCAL);
     state->vm_tb_print = tb_extern_create(mod, -1, "vm_tb_print", TB_EXTERNAL_SO_LOCAL);
     state->vm_tb_report_err = tb_extern_create(mod, -1, "vm_tb_report_err", TB_EXTERNAL_SO_LOCAL);
-    tb_symbol_bind_ptr(state->vm_tb_rfunc_comp, (void *)&vm_tb_rfunc_comp);
-    tb_symbol_bind_ptr(state->vm_table_new, (void *)&vm_table_new);
+    tb_symbol_bind_ptr(state->vm_tb_call_comp, (void *)&vm_tb_call_comp);
+    tb_symbol_bind_ptr(state->vm_tb_int_call, (void *)&vm_tb_int_call);
+    tb_symbol_bind_ptr(state->vm_tb_tail_args, (void *)&vm_tb_tail_args);
+    tb_symbol_bind_ptr(state->vm_nursery_alloc, (void *)&vm_nursery_alloc);
+    tb_symbol_bind_ptr(state->vm_gc_remember, (void *)&vm_gc_remember);
     tb_symbol_bind_ptr(state->vm_table_set, (void *)&vm_table_set);
     tb_symbol_bind_ptr(state->vm_table_get_pair, (void *)&vm_table_get_pair);
+    tb_symbol_bind_ptr(state->vm_table_get_cached, (void *)&vm_table_get_cached);
+    tb_symbol_bind_ptr(state->vm_table_cache_fill, (void *)&vm_table_cache_fill);
+    tb_symbol_bind_ptr(state->vm_table_set_cached, (void *)&vm_table_set_cached);
     tb_symbol_bind_ptr(state->vm_tb_print, (void *)&vm_tb_print);
     tb_symbol_bind_ptr(state->vm_tb_report_err, (void *)&vm_tb_report_err);
 }
 
-vm_std_value_t vm_tb_comp_call(vm_tb_comp_state_t *comp, vm_value_t *args) {
-    vm_rblock_t *rblock = comp->rblock;
-
-    if (rblock->jit != NULL) {
-        vm_tb_comp_t *new_func = rblock->jit;
-        comp->func = new_func;
-        return new_func(NULL, args);
+// args for continuations reached by a tail call, read before the
+// continuation can make another one so a buffer per thread is enough. the
+// collector does not scan it, nothing allocates a table or closure between
+// the store and the continuation loading its args into its own frame
+static _Thread_local vm_value_t *vm_tb_tail_args_buf;
+static _Thread_local size_t vm_tb_tail_args_alloc;
+
+vm_value_t *vm_tb_tail_args(size_t nargs) {
+    if (nargs > vm_tb_tail_args_alloc) {
+        vm_tb_tail_args_alloc = nargs * 2;
+        vm_tb_tail_args_buf = vm_realloc(vm_tb_tail_args_buf, sizeof(vm_value_t) * vm_tb_tail_args_alloc);
     }
+    return vm_tb_tail_args_buf;
+}
 
+vm_std_value_t vm_tb_int_call(vm_tb_comp_state_t *comp, vm_value_t *args) {
+    vm_rblock_t *rblock = comp->rblock;
     vm_tb_state_t *state = rblock->state;
+    vm_block_t *block = rblock->block;
+    vm_std_value_t *std_args = vm_malloc(sizeof(vm_std_value_t) * (block->nargs + 1));
+    for (size_t i = 0; i < block->nargs; i++) {
+        std_args[i] = (vm_std_value_t){
+            .tag = rblock->regs->tags[block->args[i].reg],
+            .value = args[i],
+        };
+    }
+    vm_std_value_t ret = vm_int_run(&state->interp, block, std_args);
+    vm_free(std_args);
+    return ret;
+}
 
-    // vm_tb_state_t *state = vm_malloc(sizeof(vm_tb_state_t));
-    // state->std = last_state->std;
-    // state->config = last_state->config;
-    // state->nblocks = last_state->nblocks;
-    // state->blocks = last_state->blocks;
-
-    // vm_tb_new_module(state);
+// typed entry for a function that is out of versions, it boxes the params
+// and hands them to vm_tb_int_call
+static void *vm_tb_int_stub(vm_tb_state_t *state, vm_rblock_t *rblock) {
+    vm_block_t *block = rblock->block;
 
-    state->faults = 0;
+    TB_Function *fun = tb_function_create(state->module, -1, "generic", TB_LINKAGE_PRIVATE);
 
-    vm_block_t *block = vm_rblock_version(state->nblocks, state->blocks, rblock);
-    // if (block == NULL) {
-    //     vm_print_block(stderr, rblock->block);
-    //     __builtin_trap();
-    // }
-    TB_Function *fun = tb_function_create(state->module, -1, "block", TB_LINKAGE_PRIVATE);
+    TB_PrototypeParam *proto_args = vm_malloc(sizeof(TB_PrototypeParam) * block->nargs);
 
-    TB_PrototypeParam proto_params[2] = {
-        {TB_TYPE_PTR},
-        {TB_TYPE_PTR},
-    };
+    for (size_t arg = 0; arg < block->nargs; arg++) {
+        proto_args[arg] = (TB_PrototypeParam){
+            vm_tag_to_tb_type(rblock->regs->tags[block->args[arg].reg]),
+        };
+    }
 
     TB_PrototypeParam proto_rets[2] = {
         {TB_TYPE_PTR},
         {TB_TYPE_I32},
     };
 
-    TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, 2, proto_params, 2, proto_rets, false);
+    TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, block->nargs, proto_args, 2, proto_rets, false);
     tb_function_set_prototype(
         fun,
         -1,
@@ -1337,93 +2269,60 @@ vm_std_value_t vm_tb_comp_call(vm_tb_comp_state_t *comp, vm_value_t *args) {
         NULL
     );
 
-    TB_Node **regs = vm_malloc(sizeof(TB_Node *) * block->nregs);
-
-    for (size_t i = 0; i < block->nregs; i++) {
-        regs[i] = tb_inst_local(fun, 8, 8);
-    }
+    TB_Node *args = tb_inst_local(fun, sizeof(vm_value_t) * (block->nargs + 1), 8);
 
     for (size_t i = 0; i < block->nargs; i++) {
         tb_inst_store(
             fun,
-            vm_tag_to_tb_type(block->args[i].reg_tag),
-            regs[block->args[i].reg],
-            tb_inst_load(
-                fun,
-                vm_tag_to_tb_type(block->args[i].reg_tag),
-                tb_inst_member_access(fun, tb_inst_param(fun, 1), sizeof(vm_value_t) * i),
-                1,
-                false
-            ),
+            vm_tag_to_tb_type(rblock->regs->tags[block->args[i].reg]),
+            tb_inst_member_access(fun, args, sizeof(vm_value_t) * i),
+            tb_inst_param(fun, i),
             8,
             false
         );
-        if (state->config->dump_args) {
-            vm_tb_func_print_value(state, fun, rblock->regs->tags[block->args[i].reg], regs[block->args[i].reg]);
-        }
     }
 
-    vm_tb_func_reset_pass(block);
-    TB_Node *main = vm_tb_func_body_once(state, fun, regs, block);
-    vm_tb_func_reset_pass(block);
+    vm_tb_comp_state_t *comp = vm_malloc(sizeof(vm_tb_comp_state_t));
+    *comp = (vm_tb_comp_state_t){
+        .func = &vm_tb_int_call,
+        .rblock = rblock,
+        .state = state,
+    };
 
-    tb_inst_goto(fun, main);
+    TB_PrototypeParam call_params[2] = {
+        {TB_TYPE_PTR},
+        {TB_TYPE_PTR},
+    };
 
-    TB_Passes *passes = tb_pass_enter(fun, tb_function_get_arena(fun));
-#if VM_USE_DUMP
-    if (state->config->dump_tb) {
-        fprintf(stdout, "\n--- tb ---\n");
-        tb_pass_print(passes);
-    }
-    if (state->config->dump_tb_dot) {
-        fprintf(stdout, "\n--- tb dot ---\n");
-        tb_pass_print_dot(passes, tb_default_print_callback, stdout);
-    }
-    if (state->config->use_tb_opt) {
-        tb_pass_optimize(passes);
-        if (state->config->dump_tb_opt) {
-            fprintf(stdout, "\n--- opt tb ---\n");
-            tb_pass_print(passes);
-        }
-        if (state->config->dump_tb_dot) {
-            fprintf(stdout, "\n--- opt dot ---\n");
-            tb_pass_print_dot(passes, tb_default_print_callback, stdout);
-        }
-    }
-#endif
-#if VM_USE_DUMP
-    if (state->config->dump_x86) {
-        TB_FunctionOutput *out = tb_pass_codegen(passes, true);
-        fprintf(stdout, "\n--- x86asm ---\n");
-        tb_output_print_asm(out, stdout);
-    } else {
-        tb_pass_codegen(passes, false);
-    }
-#else
-    tb_pass_codegen(passes, false);
-#endif
+    TB_FunctionPrototype *call_proto = tb_prototype_create(state->module, VM_TB_CC, 2, call_params, 2, proto_rets, false);
 
-    tb_pass_exit(passes);
+    TB_Node *call_args[2] = {
+        vm_tb_ptr_name(state->module, fun, "<data>", comp),
+        args,
+    };
 
-    TB_JIT *jit = tb_jit_begin(state->module, 1 << 16);
-    vm_tb_comp_t *new_func = tb_jit_place_function(jit, fun);
+    TB_Node **got = tb_inst_call(
+                        fun,
+                        call_proto,
+                        tb_inst_get_symbol_address(fun, state->vm_tb_int_call),
+                        2,
+                        call_args
+    )
+                        .multiple;
 
-    comp->func = new_func;
+    tb_inst_ret(fun, 2, got);
 
-    rblock->jit = new_func;
+    TB_Passes *passes = tb_pass_enter(fun, tb_function_get_arena(fun));
+    TB_FunctionOutput *out = tb_pass_codegen(passes, false);
+    tb_pass_exit(passes);
 
-    return new_func(NULL, args);
+    return vm_tb_jit_place(state, fun, out);
 }
 
-void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
-    void *cache = rblock->jit;
-    if (cache != NULL) {
-        return cache;
-    }
-
-    rblock->count += 1;
-
-    vm_tb_state_t *state = rblock->state;
+// lowers one version into its own TB function, with is_func the params are
+// the typed args, otherwise a vm_tb_comp_t continuation, this walks and makes
+// versions so it needs state->lock
+static TB_Function *vm_tb_rblock_build(vm_tb_state_t *state, vm_rblock_t *rblock, bool is_func) {
     state->faults = 0;
 
     vm_block_t *block = vm_rblock_version(state->nblocks, state->blocks, rblock);
@@ -1433,21 +2332,31 @@ void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
     // }
     TB_Function *fun = tb_function_create(state->module, -1, "block", TB_LINKAGE_PRIVATE);
 
-    TB_PrototypeParam *proto_args = vm_malloc(sizeof(TB_PrototypeParam) * block->nargs);
-
-    for (size_t arg = 0; arg < block->nargs; arg++) {
-        size_t reg = block->args[arg].reg;
-        proto_args[arg] = (TB_PrototypeParam){
-            vm_tag_to_tb_type(rblock->regs->tags[reg]),
-        };
-    }
-
     TB_PrototypeParam proto_rets[2] = {
         {TB_TYPE_PTR},
         {TB_TYPE_I32},
     };
 
-    TB_FunctionPrototype *proto = tb_prototype_create(state->module, VM_TB_CC, block->nargs, proto_args, 2, proto_rets, false);
+    TB_FunctionPrototype *proto;
+    if (is_func) {
+        TB_PrototypeParam *proto_args = vm_malloc(sizeof(TB_PrototypeParam) * block->nargs);
+
+        for (size_t arg = 0; arg < block->nargs; arg++) {
+            size_t reg = block->args[arg].reg;
+            proto_args[arg] = (TB_PrototypeParam){
+                vm_tag_to_tb_type(rblock->regs->tags[reg]),
+            };
+        }
+
+        proto = tb_prototype_create(state->module, VM_TB_CC, block->nargs, proto_args, 2, proto_rets, false);
+    } else {
+        TB_PrototypeParam proto_params[2] = {
+            {TB_TYPE_PTR},
+            {TB_TYPE_PTR},
+        };
+
+        proto = tb_prototype_create(state->module, VM_TB_CC, 2, proto_params, 2, proto_rets, false);
+    }
     tb_function_set_prototype(
         fun,
         -1,
@@ -1462,11 +2371,23 @@ void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
     }
 
     for (size_t i = 0; i < block->nargs; i++) {
+        TB_Node *value;
+        if (is_func) {
+            value = tb_inst_param(fun, i);
+        } else {
+            value = tb_inst_load(
+                fun,
+                vm_tag_to_tb_type(block->args[i].reg_tag),
+                tb_inst_member_access(fun, tb_inst_param(fun, 1), sizeof(vm_value_t) * i),
+                1,
+                false
+            );
+        }
         tb_inst_store(
             fun,
             vm_tag_to_tb_type(block->args[i].reg_tag),
             regs[block->args[i].reg],
-            tb_inst_param(fun, i),
+            value,
             8,
             false
         );
@@ -1476,11 +2397,23 @@ void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
     }
 
     vm_tb_func_reset_pass(block);
+    if (state->config->use_loop) {
+        vm_tb_func_version_seen(state, block);
+        vm_tb_func_reset_pass(block);
+        vm_block_find_loops(block);
+    }
     TB_Node *main = vm_tb_func_body_once(state, fun, regs, block);
     vm_tb_func_reset_pass(block);
 
     tb_inst_goto(fun, main);
 
+    vm_free(regs);
+
+    return fun;
+}
+
+// runs the TB passes over fun, they only touch fun so the lock is not needed
+static TB_FunctionOutput *vm_tb_func_codegen(vm_tb_state_t *state, TB_Function *fun, bool opt) {
     TB_Passes *passes = tb_pass_enter(fun, tb_function_get_arena(fun));
 #if VM_USE_DUMP
     if (state->config->dump_tb) {
@@ -1491,8 +2424,10 @@ void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
         fprintf(stdout, "\n--- tb dot ---\n");
         tb_pass_print_dot(passes, tb_default_print_callback, stdout);
     }
-    if (state->config->use_tb_opt) {
+#endif
+    if (opt) {
         tb_pass_optimize(passes);
+#if VM_USE_DUMP
         if (state->config->dump_tb_opt) {
             fprintf(stdout, "\n--- opt tb ---\n");
             tb_pass_print(passes);
@@ -1501,25 +2436,219 @@ void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
             fprintf(stdout, "\n--- opt dot ---\n");
             tb_pass_print_dot(passes, tb_default_print_callback, stdout);
         }
-    }
 #endif
+    }
 #if VM_USE_DUMP
+    TB_FunctionOutput *out = tb_pass_codegen(passes, state->config->dump_x86);
     if (state->config->dump_x86) {
-        TB_FunctionOutput *out = tb_pass_codegen(passes, true);
         fprintf(stdout, "\n--- x86asm ---\n");
         tb_output_print_asm(out, stdout);
-    } else {
-        tb_pass_codegen(passes, false);
     }
 #else
-    tb_pass_codegen(passes, false);
+    TB_FunctionOutput *out = tb_pass_codegen(passes, false);
 #endif
     tb_pass_exit(passes);
 
-    TB_JIT *jit = tb_jit_begin(state->module, 1 << 16);
-    void *ret = tb_jit_place_function(jit, fun);
+    return out;
+}
+
+// makes one version and places it, call with state->lock held
+static void *vm_tb_rblock_comp(vm_tb_state_t *state, vm_rblock_t *rblock, bool is_func, bool opt) {
+    TB_Function *fun = vm_tb_rblock_build(state, rblock, is_func);
+    TB_FunctionOutput *out = vm_tb_func_codegen(state, fun, opt);
+    return vm_tb_jit_place(state, fun, out);
+}
+
+// remembers that slot holds a copy of rblock->jit, so the background
+// compile can repoint it, call with state->lock held
+static void vm_tb_rblock_use(vm_tb_state_t *state, vm_rblock_t *rblock, void **slot) {
+    if (!state->config->use_bg_jit) {
+        return;
+    }
+    if (rblock->uses.len + 1 >= rblock->uses.alloc) {
+        rblock->uses.alloc = (rblock->uses.len + 1) * 2;
+        rblock->uses.ptr = vm_realloc(rblock->uses.ptr, sizeof(void **) * rblock->uses.alloc);
+    }
+    rblock->uses.ptr[rblock->uses.len++] = slot;
+}
+
+// the first version of rblock is the quick one, with use_bg_jit an optimized
+// one is compiled in the background and replaces it everywhere it was copied
+static void *vm_tb_rblock_first_comp(vm_tb_state_t *state, vm_rblock_t *rblock, bool is_func) {
+    bool bg = state->config->use_bg_jit;
+    void *ret = vm_tb_rblock_comp(state, rblock, is_func, state->config->use_tb_opt && !bg);
+    __atomic_store_n(&rblock->jit, ret, __ATOMIC_RELEASE);
+    if (bg) {
+        if (state->jobs.len + 1 >= state->jobs.alloc) {
+            state->jobs.alloc = (state->jobs.len + 1) * 2;
+            state->jobs.ptr = vm_realloc(state->jobs.ptr, sizeof(vm_tb_job_t) * state->jobs.alloc);
+        }
+        state->jobs.ptr[state->jobs.len++] = (vm_tb_job_t){
+            .rblock = rblock,
+            .is_func = is_func,
+        };
+#if defined(VM_TB_USE_THREADS)
+        cnd_signal(&state->wake);
+#endif
+    }
+    return ret;
+}
+
+#if defined(VM_TB_USE_THREADS)
+static int vm_tb_bg_main(void *arg) {
+    vm_tb_state_t *state = arg;
+    vm_tb_lock(state);
+    while (true) {
+        while (state->jobs.len == 0 && !state->stop) {
+            cnd_wait(&state->wake, &state->lock);
+        }
+        if (state->jobs.len == 0) {
+            break;
+        }
+        vm_tb_job_t job = state->jobs.ptr[--state->jobs.len];
+        vm_rblock_t *rblock = job.rblock;
+        TB_Function *fun = vm_tb_rblock_build(state, rblock, job.is_func);
+        // the optimizer and codegen are most of the time, the mutator keeps
+        // compiling and running while they go
+        vm_tb_unlock(state);
+        TB_FunctionOutput *out = vm_tb_func_codegen(state, fun, true);
+        vm_tb_lock(state);
+        void *code = vm_tb_jit_place(state, fun, out);
+        __atomic_store_n(&rblock->jit, code, __ATOMIC_RELEASE);
+        if (rblock->sym != NULL) {
+            tb_symbol_bind_ptr(rblock->sym, code);
+        }
+        for (size_t i = 0; i < rblock->uses.len; i++) {
+            __atomic_store_n(rblock->uses.ptr[i], code, __ATOMIC_RELEASE);
+        }
+        state->bg_done += 1;
+    }
+    vm_tb_unlock(state);
+    return 0;
+}
+#endif
+
+void *vm_tb_call_comp(vm_tb_state_t *state, vm_branch_t *branch, int32_t block_num, void **slot) {
+    if (block_num < 0 || (size_t)block_num >= state->nblocks) {
+        vm_tb_report_err("call of a bad function");
+    }
+    vm_tb_lock(state);
+    vm_rblock_t *rblock = vm_rblock_call_target(state->blocks, branch, (size_t)block_num);
+    if (rblock == NULL) {
+        vm_tb_report_err("wrong number of args");
+    }
+    rblock->state = state;
+    vm_branch_add_callee(branch, block_num);
+    vm_tb_unlock(state);
+    vm_tb_rfunc_comp(rblock);
+    vm_tb_lock(state);
+    void *ret = rblock->jit;
+    __atomic_store_n(slot, ret, __ATOMIC_RELEASE);
+    vm_tb_rblock_use(state, rblock, slot);
+    vm_tb_unlock(state);
+    return ret;
+}
+
+vm_std_value_t vm_tb_comp_call(vm_tb_comp_state_t *comp, vm_value_t *args) {
+    vm_tb_state_t *state = comp->state;
+
+    vm_tb_lock(state);
+
+    vm_rblock_t *rblock = comp->rblock;
+
+    if (rblock == NULL) {
+        rblock = vm_rblock_next(comp->branch, comp->tag);
+        rblock->state = state;
+        comp->rblock = rblock;
+    }
+
+    vm_tb_comp_t *new_func = __atomic_load_n(&rblock->jit, __ATOMIC_ACQUIRE);
+
+    if (new_func == NULL) {
+        if (vm_tb_versions_full(state, rblock)) {
+            vm_tb_unlock(state);
+            comp->func = &vm_tb_int_call;
+            return vm_tb_int_call(comp, args);
+        }
+        new_func = vm_tb_rblock_first_comp(state, rblock, false);
+    }
+
+    comp->func = new_func;
+    vm_tb_rblock_use(state, rblock, (void **)&comp->func);
+
+    vm_tb_unlock(state);
+
+    return new_func(NULL, args);
+}
+
+static bool vm_tb_int_hot(void *hot_data, vm_block_t *block, vm_std_value_t *args, vm_std_value_t *ret) {
+    vm_tb_state_t *state = hot_data;
+    vm_tag_t tags[block->nregs + 1];
+    for (size_t i = 0; i < block->nregs; i++) {
+        tags[i] = VM_TAG_UNK;
+    }
+    for (size_t i = 0; i < block->nargs; i++) {
+        tags[block->args[i].reg] = args[i].tag;
+    }
+    vm_tags_t regs = (vm_tags_t){
+        .ntags = block->nregs,
+        .tags = tags,
+    };
+    vm_rblock_t key = (vm_rblock_t){
+        .block = block,
+        .regs = &regs,
+    };
+    vm_cache_t *entries = &state->entries[block->id];
+    vm_tb_lock(state);
+    vm_tb_comp_state_t *comp = vm_cache_get(entries, &key);
+    if (comp == NULL) {
+        if (vm_tb_versions_full(state, &key)) {
+            vm_tb_unlock(state);
+            return false;
+        }
+        vm_rblock_t *rblock = vm_rblock_new(block, vm_rblock_regs_dup(&regs, block->nregs));
+        rblock->state = state;
+        comp = vm_malloc(sizeof(vm_tb_comp_state_t));
+        *comp = (vm_tb_comp_state_t){
+            .func = &vm_tb_comp_call,
+            .rblock = rblock,
+            .state = state,
+        };
+        vm_cache_set(entries, rblock, comp);
+    }
+    vm_tb_unlock(state);
+    vm_value_t values[block->nargs + 1];
+    for (size_t i = 0; i < block->nargs; i++) {
+        values[i] = args[i].value;
+    }
+    *ret = comp->func(comp, values);
+    return true;
+}
+
+void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
+    void *cache = __atomic_load_n(&rblock->jit, __ATOMIC_ACQUIRE);
+    if (cache != NULL) {
+        return cache;
+    }
+
+    vm_tb_state_t *state = rblock->state;
+
+    vm_tb_lock(state);
+
+    if (rblock->jit != NULL) {
+        vm_tb_unlock(state);
+        return rblock->jit;
+    }
+
+    rblock->count += 1;
 
-    rblock->jit = ret;
+    if (vm_tb_versions_full(state, rblock)) {
+        rblock->jit = vm_tb_int_stub(state, rblock);
+        vm_tb_unlock(state);
+        return rblock->jit;
+    }
+
+    void *ret = vm_tb_rblock_first_comp(state, rblock, true);
 
     if (state->faults < rblock->least_faults) {
         rblock->least_faults = state->faults;
@@ -1532,6 +2661,8 @@ void *vm_tb_rfunc_comp(vm_rblock_t *rblock) {
         rblock->redo = rblock->base_redo;
     }
 
+    vm_tb_unlock(state);
+
     // printf("block #%zi with %zu faults\n", rblock->block->id, state->faults);
 
     // printf("code buf: %p\n", ret);
@@ -1551,13 +2682,64 @@ typedef vm_std_value_t VM_CDECL vm_tb_func_t(void);
 
 vm_std_value_t vm_tb_run(vm_config_t *config, size_t nblocks, vm_block_t **blocks, vm_table_t *std) {
     vm_tb_state_t *state = vm_malloc(sizeof(vm_tb_state_t));
-    state->std = std;
-    state->config = config;
-    state->nblocks = nblocks;
-    state->blocks = blocks;
+    *state = (vm_tb_state_t){
+        .std = std,
+        .config = config,
+        .nblocks = nblocks,
+        .blocks = blocks,
+    };
 
+    vm_int_init(&state->interp, config, nblocks, blocks, std);
     vm_tb_new_module(state);
 
-    vm_tb_func_t *fn = (vm_tb_func_t *)vm_tb_full_comp(state, blocks[0]);
-    return fn();
+#if defined(VM_TB_USE_THREADS)
+    mtx_init(&state->lock, mtx_plain);
+    if (config->use_bg_jit) {
+        cnd_init(&state->wake);
+        thrd_create(&state->bg, &vm_tb_bg_main, state);
+    }
+#endif
+
+    vm_std_value_t ret;
+    if (config->hot_runs == 0) {
+        vm_tb_func_t *fn = (vm_tb_func_t *)vm_tb_full_comp(state, blocks[0]);
+        ret = fn();
+    } else {
+        state->entries = vm_malloc(sizeof(vm_cache_t) * nblocks);
+        for (size_t i = 0; i < nblocks; i++) {
+            vm_cache_new(&state->entries[i]);
+        }
+        state->interp.hot = &vm_tb_int_hot;
+        state->interp.hot_data = state;
+        ret = vm_int_run(&state->interp, blocks[0], NULL);
+    }
+
+#if defined(VM_TB_USE_THREADS)
+    if (config->use_bg_jit) {
+        vm_tb_lock(state);
+        state->stop = true;
+        // whatever is still queued would only be thrown away
+        state->jobs.len = 0;
+        cnd_signal(&state->wake);
+        vm_tb_unlock(state);
+        thrd_join(state->bg, NULL);
+        cnd_destroy(&state->wake);
+    }
+    mtx_destroy(&state->lock);
+#endif
+
+#if VM_USE_DUMP
+    if (config->dump_jit) {
+        fprintf(stdout, "\n--- jit ---\n");
+        fprintf(stdout, "functions: %zu\n", state->jit_stats.funcs);
+        fprintf(stdout, "heaps: %zu\n", state->jit_stats.heaps);
+        fprintf(stdout, "bytes used: %zu\n", state->jit_stats.used);
+        fprintf(stdout, "bytes mapped: %zu\n", state->jit_stats.mapped);
+        if (config->use_bg_jit) {
+            fprintf(stdout, "background compiles: %zu\n", state->bg_done);
+        }
+    }
+#endif
+
+    return ret;
 }
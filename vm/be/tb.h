@@ -8,27 +8,88 @@
 #include "../std/libs/io.h"
 #include "../std/std.h"
 #include "../type.h"
+#include "./int.h"
+
+// --bg-jit runs the optimizing compiles on a C11 thread, it is left out
+// where there is no <threads.h>, as on macOS
+#if defined(__has_include)
+#if __has_include(<threads.h>)
+#define VM_TB_USE_THREADS 1
+#endif
+#elif !defined(__STDC_NO_THREADS__)
+#define VM_TB_USE_THREADS 1
+#endif
+
+#if defined(VM_TB_USE_THREADS)
+#include <threads.h>
+#endif
 
 struct vm_tb_state_t;
 struct vm_tb_comp_state_t;
+struct vm_tb_job_t;
+struct vm_tb_loop_t;
 
 typedef struct vm_tb_state_t vm_tb_state_t;
 typedef struct vm_tb_comp_state_t vm_tb_comp_state_t;
+typedef struct vm_tb_job_t vm_tb_job_t;
 
 typedef vm_std_value_t VM_CDECL vm_tb_comp_t(vm_tb_comp_state_t *comp, vm_value_t *args);
 
+struct vm_tb_job_t {
+    vm_rblock_t *rblock;
+    bool is_func;
+};
+
 struct vm_tb_state_t {
     void *module;
+#if defined(VM_TB_USE_THREADS)
+    // held while using the module, by the mutator and the background compiler
+    mtx_t lock;
+    cnd_t wake;
+    thrd_t bg;
+#endif
+    // with use_bg_jit: versions waiting for an optimized compile
+    bool stop;
+    size_t bg_done;
+    struct {
+        size_t len;
+        vm_tb_job_t *ptr;
+        size_t alloc;
+    } jobs;
+    // the TB_JIT code is placed in
+    void *jit;
+    struct {
+        size_t funcs;
+        size_t heaps;
+        size_t used;
+        size_t mapped;
+    } jit_stats;
     size_t faults;
+    // with use_loop: loops whose body is being made, innermost first
+    struct vm_tb_loop_t *loops;
+    // tables and closures made by jit code come from here, compiled code has
+    // its address so it is per state rather than per thread
+    vm_nursery_t nursery;
     vm_config_t *config;
     size_t nblocks;
     vm_block_t **blocks;
 
+    // runs code until it is hot, and versions past config->max_versions
+    vm_int_state_t interp;
+    // code the interpreter enters once a block is hot, by block id
+    vm_cache_t *entries;
+
     // externals
-    void *vm_tb_rfunc_comp;
-    void *vm_table_new;
+    void *vm_tb_call_comp;
+    void *vm_tb_int_call;
+    void *vm_tb_tail_args;
+    void *vm_nursery_alloc;
+    void *vm_gc_remember;
     void *vm_table_set;
     void *vm_table_get_pair;
+    void *vm_table_get_cached;
+    void *vm_table_cache_fill;
+    void *vm_table_set_cached;
     void *vm_tb_print;
     void *vm_tb_report_err;
     void *std;
@@ -37,12 +98,19 @@ struct vm_tb_state_t {
 struct vm_tb_comp_state_t {
     // func must be first
     vm_tb_comp_t *func;
+    // NULL until the first call, then made from branch and tag
     vm_rblock_t *rblock;
+    vm_branch_t *branch;
+    vm_tag_t tag;
+    vm_tb_state_t *state;
 };
 
 
 void *vm_tb_rfunc_comp(vm_rblock_t *rblock);
 vm_std_value_t vm_tb_run(vm_config_t *config, size_t nblocks, vm_block_t **blocks, vm_table_t *std);
 vm_std_value_t vm_tb_comp_call(vm_tb_comp_state_t *comp, vm_value_t *args);
+vm_std_value_t vm_tb_int_call(vm_tb_comp_state_t *comp, vm_value_t *args);
+vm_value_t *vm_tb_tail_args(size_t nargs);
+void *vm_tb_call_comp(vm_tb_state_t *state, vm_branch_t *branch, int32_t block_num, void **slot);
 
 #endif
@@ -32,7 +32,7 @@ bool vm_check_instr(vm_instr_t instr) {
         case VM_IOP_MOD: {
             vm_tag_t a0 = vm_check_get_tag(instr.args[0]);
             vm_tag_t a1 = vm_check_get_tag(instr.args[1]);
-            return vm_check_is_math(a0) && vm_check_is_math(a1) && a0 == a1;
+            return vm_check_is_math(a0) && vm_check_is_math(a1);
         }
         default: {
             return true;
@@ -46,7 +46,7 @@ bool vm_check_branch(vm_branch_t branch) {
         case VM_BOP_BLT: {
             vm_tag_t a0 = vm_check_get_tag(branch.args[0]);
             vm_tag_t a1 = vm_check_get_tag(branch.args[1]);
-            return vm_check_is_math(a0) && vm_check_is_math(a1) && a0 == a1;
+            return vm_check_is_math(a0) && vm_check_is_math(a1);
         }
         case VM_BOP_CALL: {
             if (branch.args[0].type == VM_ARG_RFUNC) {
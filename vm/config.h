@@ -10,9 +10,16 @@
 #define VM_USE_LEAKS_TGC 1
 #define VM_USE_LEAKS_BDWGC 2
 
+// default for --gc
 #define VM_USE_LEAKS VM_USE_LEAKS_NOGC
 #define VM_USE_DUMP 1
 
+// default for --max-versions, 0 means no limit
+#define VM_USE_MAX_VERSIONS 32
+// default for --hot, times a block runs in the interpreter before it is
+// jitted, 0 means jit everything from the start
+#define VM_USE_HOT_RUNS 64
+
 struct vm_config_t;
 typedef struct vm_config_t vm_config_t;
 
@@ -26,9 +33,15 @@ enum {
 };
 
 struct vm_config_t {
+    size_t max_versions;
+    size_t hot_runs;
     uint8_t use_num: 3;
     bool use_tb_opt: 1;
     bool use_tailcall: 1;
+    bool use_region: 1;
+    bool use_bg_jit: 1;
+    bool use_promote: 1;
+    bool use_loop: 1;
     
     bool dump_src: 1;
     bool dump_ast: 1;
@@ -41,6 +54,7 @@ struct vm_config_t {
     bool dump_x86: 1;
     bool dump_args: 1;
     bool dump_time: 1;
+    bool dump_jit: 1;
 };
 
 #endif
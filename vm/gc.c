@@ -0,0 +1,439 @@
+#include "./gc.h"
+
+#include "./obj.h"
+
+#include <setjmp.h>
+
+#define VM_GC_ALIGN(size_) (((size_t)(size_) + 7) & ~(size_t)7)
+
+int GC_expand_hp(size_t bytes);
+void GC_set_all_interior_pointers(int value);
+
+uint8_t vm_mem_gc = VM_USE_LEAKS;
+
+// non moving, generational through sticky marks: a minor collection only
+// sweeps the chunks taken since the last one and only walks objects that are
+// not marked yet, starting from the roots and the remembered old tables.
+// the heap is walked precisely by tag, the native stack, jit frames
+// included, is scanned conservatively since there are no stack maps
+
+// the first collection is minor once this much has been taken
+#define VM_GC_MINOR_BYTES (8 * 1024 * 1024)
+// and the first full one once this much has lived through one
+#define VM_GC_FULL_BYTES (32 * 1024 * 1024)
+// free space between living objects smaller than this is not reused
+#define VM_GC_HOLE_BYTES (VM_NURSERY_CHUNK / 64)
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    // may hold objects that are not marked, so a minor collection sweeps it
+    bool young;
+} vm_gc_chunk_t;
+
+static struct {
+    void *stack_base;
+    // sorted by base, so a conservative pointer finds its chunk quickly
+    vm_gc_chunk_t *chunks;
+    size_t nchunks;
+    size_t chunks_alloc;
+    vm_nursery_t **nurseries;
+    size_t nnurseries;
+    void **roots;
+    size_t nroots;
+    vm_gc_header_t **remembered;
+    size_t nremembered;
+    size_t remembered_alloc;
+    vm_gc_header_t **stack;
+    size_t nstack;
+    size_t stack_alloc;
+    // dead space in old chunks that nurseries can fill again
+    vm_gc_header_t **holes;
+    size_t nholes;
+    size_t holes_alloc;
+    size_t young_bytes;
+    size_t old_bytes;
+    size_t full_bytes;
+    bool collecting;
+} vm_gc;
+
+void vm_mem_init(uint8_t gc, void *stack_base) {
+    vm_mem_gc = gc;
+    if (gc == VM_USE_LEAKS_BDWGC) {
+        // string bytes are only pointed into
+        GC_set_all_interior_pointers(1);
+        GC_init();
+        // small heaps would otherwise collect many times on the way up
+        GC_expand_hp(VM_GC_FULL_BYTES);
+    }
+    if (gc == VM_USE_LEAKS_TGC) {
+        vm_gc.stack_base = stack_base;
+        vm_gc.full_bytes = VM_GC_FULL_BYTES;
+    }
+}
+
+void vm_gc_add_root(void *obj) {
+    // from the bdwgc heap when that is in use, so the roots are found there too
+    vm_gc.roots = vm_realloc(vm_gc.roots, sizeof(void *) * (vm_gc.nroots + 1));
+    vm_gc.roots[vm_gc.nroots++] = obj;
+}
+
+void vm_gc_remember(void *obj) {
+    vm_gc_header_t *header = (vm_gc_header_t *)obj - 1;
+    if (header->remembered) {
+        return;
+    }
+    header->remembered = 1;
+    if (vm_gc.nremembered + 1 >= vm_gc.remembered_alloc) {
+        vm_gc.remembered_alloc = (vm_gc.nremembered + 1) * 2;
+        vm_gc.remembered = realloc(vm_gc.remembered, sizeof(vm_gc_header_t *) * vm_gc.remembered_alloc);
+    }
+    vm_gc.remembered[vm_gc.nremembered++] = header;
+}
+
+static void vm_gc_push(vm_gc_header_t *header) {
+    if (header->mark || header->kind == VM_GC_KIND_DEAD) {
+        return;
+    }
+    header->mark = 1;
+    if (vm_gc.nstack + 1 >= vm_gc.stack_alloc) {
+        vm_gc.stack_alloc = (vm_gc.nstack + 1) * 2;
+        vm_gc.stack = realloc(vm_gc.stack, sizeof(vm_gc_header_t *) * vm_gc.stack_alloc);
+    }
+    vm_gc.stack[vm_gc.nstack++] = header;
+}
+
+static void vm_gc_push_value(vm_value_t value, uint32_t tag) {
+    if ((tag == VM_TAG_TAB || tag == VM_TAG_CLOSURE) && value.all != NULL) {
+        vm_gc_push((vm_gc_header_t *)value.all - 1);
+    }
+}
+
+static vm_gc_chunk_t *vm_gc_chunk_of(uint8_t *ptr) {
+    size_t lo = 0;
+    size_t hi = vm_gc.nchunks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (vm_gc.chunks[mid].base <= ptr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    vm_gc_chunk_t *chunk = &vm_gc.chunks[lo - 1];
+    if (ptr >= chunk->base + chunk->size) {
+        return NULL;
+    }
+    return chunk;
+}
+
+// the object a word on the stack points into, if any
+static vm_gc_header_t *vm_gc_find(uint8_t *ptr) {
+    vm_gc_chunk_t *chunk = vm_gc_chunk_of(ptr);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    size_t used = 0;
+    while (used + sizeof(vm_gc_header_t) <= chunk->size) {
+        vm_gc_header_t *header = (vm_gc_header_t *)&chunk->base[used];
+        if (header->kind == VM_GC_KIND_NONE) {
+            return NULL;
+        }
+        size_t next = used + sizeof(vm_gc_header_t) + VM_GC_ALIGN(header->size);
+        if (ptr < chunk->base + next) {
+            return header->kind == VM_GC_KIND_DEAD ? NULL : header;
+        }
+        used = next;
+    }
+    return NULL;
+}
+
+// reads the whole stack, redzones included
+__attribute__((no_sanitize_address)) static void vm_gc_scan(void *lo, void *hi) {
+    uintptr_t start = ((uintptr_t)lo + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1);
+    for (void **word = (void **)start; (void *)(word + 1) <= hi; word++) {
+        vm_gc_header_t *header = vm_gc_find(*word);
+        if (header != NULL) {
+            vm_gc_push(header);
+        }
+    }
+}
+
+static void vm_gc_trace(vm_gc_header_t *header) {
+    switch (header->kind) {
+        case VM_GC_KIND_TABLE: {
+            vm_table_t *table = (vm_table_t *)(header + 1);
+            if (table->shape != NULL) {
+                for (uint32_t i = 0; i < table->shape->nslots; i++) {
+                    vm_gc_push_value(table->slots[i].value, table->slots[i].tag);
+                }
+            }
+            for (uint32_t i = 0; i < table->arr_len; i++) {
+                vm_gc_push_value(table->arr[i].value, table->arr[i].tag);
+            }
+            size_t npairs = table->pairs == NULL ? 0 : (size_t)1 << table->alloc;
+            for (size_t i = 0; i < npairs; i++) {
+                vm_pair_t *pair = &table->pairs[i];
+                vm_gc_push_value(pair->key_val, pair->key_tag);
+                vm_gc_push_value(pair->val_val, pair->val_tag);
+            }
+            break;
+        }
+        case VM_GC_KIND_CLOSURE: {
+            vm_std_value_t *slots = (vm_std_value_t *)(header + 1);
+            size_t nslots = header->size / sizeof(vm_std_value_t);
+            for (size_t i = 0; i < nslots; i++) {
+                vm_gc_push_value(slots[i].value, slots[i].tag);
+            }
+            break;
+        }
+    }
+}
+
+static void vm_gc_drain(void) {
+    while (vm_gc.nstack > 0) {
+        vm_gc_trace(vm_gc.stack[--vm_gc.nstack]);
+    }
+}
+
+static void vm_gc_hole_add(vm_gc_header_t *header) {
+    if (vm_gc.nholes + 1 >= vm_gc.holes_alloc) {
+        vm_gc.holes_alloc = (vm_gc.nholes + 1) * 2;
+        vm_gc.holes = realloc(vm_gc.holes, sizeof(vm_gc_header_t *) * vm_gc.holes_alloc);
+    }
+    vm_gc.holes[vm_gc.nholes++] = header;
+}
+
+// frees what was not marked and joins runs of dead objects, the tail of a
+// chunk included, into holes
+static size_t vm_gc_sweep(vm_gc_chunk_t *chunk) {
+    size_t nholes = vm_gc.nholes;
+    size_t nlive = 0;
+    size_t run = 0;
+    size_t used = 0;
+    while (used < chunk->size) {
+        vm_gc_header_t *header = (vm_gc_header_t *)&chunk->base[used];
+        size_t next = chunk->size;
+        if (header->kind != VM_GC_KIND_NONE) {
+            next = used + sizeof(vm_gc_header_t) + VM_GC_ALIGN(header->size);
+        }
+        if (header->kind == VM_GC_KIND_TABLE && !header->mark) {
+            vm_table_t *table = (vm_table_t *)(header + 1);
+            vm_free(table->slots);
+            vm_free(table->pairs);
+            vm_free(table->arr);
+        }
+        bool live = header->kind != VM_GC_KIND_NONE && header->kind != VM_GC_KIND_DEAD && header->mark;
+        if (live) {
+            nlive += 1;
+        }
+        if (live || next == chunk->size) {
+            size_t end = live ? used : next;
+            if (end > run) {
+                vm_gc_header_t *hole = (vm_gc_header_t *)&chunk->base[run];
+                *hole = (vm_gc_header_t){
+                    .size = (uint32_t)(end - run - sizeof(vm_gc_header_t)),
+                    .kind = VM_GC_KIND_DEAD,
+                };
+                if (end - run >= VM_GC_HOLE_BYTES) {
+                    vm_gc_hole_add(hole);
+                }
+            }
+            run = next;
+        }
+        used = next;
+    }
+    if (nlive == 0) {
+        vm_gc.nholes = nholes;
+    }
+    return nlive;
+}
+
+// a nursery in a hole leaves the rest of it dead so the chunk stays walkable
+static void vm_gc_nursery_close(vm_nursery_t *nursery) {
+    if (nursery->base != NULL && nursery->used < nursery->size) {
+        *(vm_gc_header_t *)&nursery->base[nursery->used] = (vm_gc_header_t){
+            .size = (uint32_t)(nursery->size - nursery->used - sizeof(vm_gc_header_t)),
+            .kind = VM_GC_KIND_DEAD,
+        };
+    }
+    *nursery = (vm_nursery_t){0};
+}
+
+static __attribute__((noinline)) void vm_gc_scan_stack(void) {
+    jmp_buf regs;
+    setjmp(regs);
+    vm_gc_scan(&regs, (uint8_t *)&regs + sizeof(jmp_buf));
+    vm_gc_scan(__builtin_frame_address(0), vm_gc.stack_base);
+}
+
+void vm_gc_collect(bool full) {
+    if (vm_gc.collecting || vm_gc.stack_base == NULL) {
+        return;
+    }
+    vm_gc.collecting = true;
+    for (size_t i = 0; i < vm_gc.nnurseries; i++) {
+        vm_gc_nursery_close(vm_gc.nurseries[i]);
+    }
+    if (full) {
+        for (size_t i = 0; i < vm_gc.nchunks; i++) {
+            vm_gc_chunk_t *chunk = &vm_gc.chunks[i];
+            for (size_t used = 0; used < chunk->size;) {
+                vm_gc_header_t *header = (vm_gc_header_t *)&chunk->base[used];
+                if (header->kind == VM_GC_KIND_NONE) {
+                    break;
+                }
+                header->mark = 0;
+                used += sizeof(vm_gc_header_t) + VM_GC_ALIGN(header->size);
+            }
+        }
+    }
+    for (size_t i = 0; i < vm_gc.nroots; i++) {
+        vm_gc_push((vm_gc_header_t *)vm_gc.roots[i] - 1);
+    }
+    for (size_t i = 0; i < vm_gc.nremembered; i++) {
+        vm_gc_header_t *header = vm_gc.remembered[i];
+        header->remembered = 0;
+        if (!full && header->kind != VM_GC_KIND_DEAD) {
+            vm_gc_trace(header);
+        }
+    }
+    vm_gc.nremembered = 0;
+    vm_gc_scan_stack();
+    vm_gc_drain();
+    // holes in chunks that get swept are found again by the sweep
+    size_t nholes = 0;
+    for (size_t i = 0; i < vm_gc.nholes; i++) {
+        vm_gc_header_t *hole = vm_gc.holes[i];
+        if (!full && !vm_gc_chunk_of((uint8_t *)hole)->young) {
+            vm_gc.holes[nholes++] = hole;
+        }
+    }
+    vm_gc.nholes = nholes;
+    size_t nchunks = 0;
+    vm_gc.old_bytes = full ? 0 : vm_gc.old_bytes;
+    for (size_t i = 0; i < vm_gc.nchunks; i++) {
+        vm_gc_chunk_t chunk = vm_gc.chunks[i];
+        if (!full && !chunk.young) {
+            vm_gc.chunks[nchunks++] = chunk;
+            continue;
+        }
+        if (vm_gc_sweep(&chunk) == 0) {
+            free(chunk.base);
+            continue;
+        }
+        chunk.young = false;
+        vm_gc.old_bytes += chunk.size;
+        vm_gc.chunks[nchunks++] = chunk;
+    }
+    vm_gc.nchunks = nchunks;
+    vm_gc.young_bytes = 0;
+    if (full) {
+        vm_gc.full_bytes = vm_gc.old_bytes * 2 > VM_GC_FULL_BYTES ? vm_gc.old_bytes * 2 : VM_GC_FULL_BYTES;
+    }
+    vm_gc.collecting = false;
+}
+
+static uint8_t *vm_gc_chunk_new(size_t size) {
+    if (vm_gc.young_bytes >= VM_GC_MINOR_BYTES) {
+        vm_gc_collect(vm_gc.old_bytes >= vm_gc.full_bytes);
+    }
+    size = (size + VM_NURSERY_CHUNK - 1) & ~(size_t)(VM_NURSERY_CHUNK - 1);
+    uint8_t *base = aligned_alloc(VM_NURSERY_CHUNK, size);
+    memset(base, 0, size);
+    if (vm_gc.nchunks + 1 >= vm_gc.chunks_alloc) {
+        vm_gc.chunks_alloc = (vm_gc.nchunks + 1) * 2;
+        vm_gc.chunks = realloc(vm_gc.chunks, sizeof(vm_gc_chunk_t) * vm_gc.chunks_alloc);
+    }
+    size_t at = vm_gc.nchunks;
+    while (at > 0 && vm_gc.chunks[at - 1].base > base) {
+        vm_gc.chunks[at] = vm_gc.chunks[at - 1];
+        at -= 1;
+    }
+    vm_gc.chunks[at] = (vm_gc_chunk_t){
+        .base = base,
+        .size = size,
+        .young = true,
+    };
+    vm_gc.nchunks += 1;
+    vm_gc.young_bytes += size;
+    return base;
+}
+
+static void vm_gc_nursery_add(vm_nursery_t *nursery) {
+    for (size_t i = 0; i < vm_gc.nnurseries; i++) {
+        if (vm_gc.nurseries[i] == nursery) {
+            return;
+        }
+    }
+    vm_gc.nurseries = realloc(vm_gc.nurseries, sizeof(vm_nursery_t *) * (vm_gc.nnurseries + 1));
+    vm_gc.nurseries[vm_gc.nnurseries++] = nursery;
+}
+
+// without tgc nothing walks the chunks, they are only bumped through. bdwgc
+// gets each object on its own, one living object would keep a whole chunk
+// and everything the dead ones in it point to
+static void *vm_nursery_alloc_bump(vm_nursery_t *nursery, uint32_t size, uint8_t kind) {
+    size_t need = sizeof(vm_gc_header_t) + VM_GC_ALIGN(size);
+    vm_gc_header_t *header;
+    if (vm_mem_gc == VM_USE_LEAKS_BDWGC || need > VM_NURSERY_CHUNK / 8) {
+        header = vm_malloc(need);
+        memset(header, 0, need);
+    } else {
+        if (nursery->used + need > nursery->size) {
+            nursery->base = vm_malloc(VM_NURSERY_CHUNK);
+            memset(nursery->base, 0, VM_NURSERY_CHUNK);
+            nursery->used = 0;
+            nursery->size = VM_NURSERY_CHUNK;
+        }
+        header = (vm_gc_header_t *)&nursery->base[nursery->used];
+        nursery->used += need;
+    }
+    header->size = size;
+    header->kind = kind;
+    return header + 1;
+}
+
+void *vm_nursery_alloc(vm_nursery_t *nursery, uint32_t size, uint8_t kind) {
+    if (vm_mem_gc != VM_USE_LEAKS_TGC) {
+        return vm_nursery_alloc_bump(nursery, size, kind);
+    }
+    size_t need = sizeof(vm_gc_header_t) + VM_GC_ALIGN(size);
+    vm_gc_header_t *header;
+    if (need > VM_NURSERY_CHUNK / 8) {
+        header = (vm_gc_header_t *)vm_gc_chunk_new(need);
+    } else {
+        if (nursery->used + need > nursery->size) {
+            vm_gc_nursery_add(nursery);
+            vm_gc_nursery_close(nursery);
+            vm_gc_header_t *hole = vm_gc.nholes == 0 ? NULL : vm_gc.holes[vm_gc.nholes - 1];
+            if (hole != NULL && sizeof(vm_gc_header_t) + hole->size >= need && vm_gc.young_bytes < VM_GC_MINOR_BYTES) {
+                vm_gc.nholes -= 1;
+                size_t size = sizeof(vm_gc_header_t) + hole->size;
+                vm_gc_chunk_of((uint8_t *)hole)->young = true;
+                vm_gc.young_bytes += size;
+                memset(hole, 0, size);
+                *nursery = (vm_nursery_t){
+                    .base = (uint8_t *)hole,
+                    .used = 0,
+                    .size = size,
+                };
+            } else {
+                uint8_t *base = vm_gc_chunk_new(VM_NURSERY_CHUNK);
+                *nursery = (vm_nursery_t){
+                    .base = base,
+                    .used = 0,
+                    .size = VM_NURSERY_CHUNK,
+                };
+            }
+        }
+        header = (vm_gc_header_t *)&nursery->base[nursery->used];
+        nursery->used += need;
+    }
+    header->size = size;
+    header->kind = kind;
+    return header + 1;
+}
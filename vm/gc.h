@@ -0,0 +1,63 @@
+#if !defined(VM_HEADER_GC)
+#define VM_HEADER_GC
+
+#include "lib.h"
+#include "tag.h"
+
+struct vm_gc_header_t;
+typedef struct vm_gc_header_t vm_gc_header_t;
+
+struct vm_nursery_t;
+typedef struct vm_nursery_t vm_nursery_t;
+
+enum {
+    // zeroed memory, nothing comes after it in a chunk
+    VM_GC_KIND_NONE,
+    // free space, maybe several dead objects joined into one
+    VM_GC_KIND_DEAD,
+    VM_GC_KIND_TABLE,
+    VM_GC_KIND_CLOSURE,
+};
+
+// every object from a nursery comes right after one of these
+struct vm_gc_header_t {
+    // bytes of the object, not counting this header
+    uint32_t size;
+    uint8_t kind;
+    // stays set once an object lives through a collection, so set means old
+    uint8_t mark;
+    // an old table that may point at young objects
+    uint8_t remembered;
+    uint8_t pad;
+};
+
+// bump allocation for objects that are never resized or freed on their own,
+// tables and closures, the arrays a table grows stay on the heap. the space
+// from base to base + size is zeroed when a nursery takes it
+struct vm_nursery_t {
+    uint8_t *base;
+    uint64_t used;
+    uint64_t size;
+};
+
+#define VM_NURSERY_CHUNK (64 * 1024)
+
+void *vm_nursery_alloc(vm_nursery_t *nursery, uint32_t size, uint8_t kind);
+
+// keeps obj and everything it reaches alive for good
+void vm_gc_add_root(void *obj);
+// called by stores of tables and closures into obj
+void vm_gc_remember(void *obj);
+void vm_gc_collect(bool full);
+
+static inline void vm_gc_barrier(void *obj, uint32_t tag) {
+    if (tag != VM_TAG_TAB && tag != VM_TAG_CLOSURE) {
+        return;
+    }
+    vm_gc_header_t *header = (vm_gc_header_t *)obj - 1;
+    if (header->mark && !header->remembered) {
+        vm_gc_remember(obj);
+    }
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "ir.h"
 
 #include "std/libs/io.h"
+#include "type.h"
 
 void vm_block_realloc(vm_block_t *block, vm_instr_t instr) {
     if (block->len + 4 >= block->alloc) {
@@ -250,6 +251,14 @@ void vm_print_instr(FILE *out, vm_instr_t val) {
             fprintf(out, "len");
             break;
         }
+        case VM_IOP_CLOSURE: {
+            fprintf(out, "closure");
+            break;
+        }
+        case VM_IOP_UPVAL: {
+            fprintf(out, "upval");
+            break;
+        }
         default: {
             fprintf(out, "<instr: %zu>", (size_t)val.op);
             break;
@@ -530,3 +539,1210 @@ vm_tag_t vm_arg_to_tag(vm_arg_t arg) {
         return VM_TAG_UNK;
     }
 }
+
+// the interpreter profiles without holding the jit lock while a background
+// compile may be reading, so a callee is written before ncallees counts it
+void vm_branch_add_callee(vm_branch_t *branch, int32_t id) {
+    uint8_t ncallees = __atomic_load_n(&branch->ncallees, __ATOMIC_RELAXED);
+    if (ncallees > VM_BRANCH_CALLEES) {
+        return;
+    }
+    for (size_t i = 0; i < ncallees; i++) {
+        if (branch->callees[i] == id) {
+            return;
+        }
+    }
+    if (ncallees < VM_BRANCH_CALLEES) {
+        branch->callees[ncallees] = id;
+    }
+    __atomic_store_n(&branch->ncallees, ncallees + 1, __ATOMIC_RELEASE);
+}
+
+void vm_branch_add_seen(vm_branch_t *branch, vm_tag_t tag) {
+    __atomic_fetch_or(&branch->seen, (uint32_t)1 << tag, __ATOMIC_RELAXED);
+    uint16_t hits = __atomic_load_n(&branch->hits[tag], __ATOMIC_RELAXED);
+    if (hits != UINT16_MAX) {
+        __atomic_store_n(&branch->hits[tag], hits + 1, __ATOMIC_RELAXED);
+    }
+}
+
+void vm_branch_copy_profile(vm_branch_t *out, vm_branch_t *branch) {
+    uint8_t ncallees = __atomic_load_n(&branch->ncallees, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < ncallees && i < VM_BRANCH_CALLEES; i++) {
+        out->callees[i] = branch->callees[i];
+    }
+    out->ncallees = ncallees;
+    out->seen = __atomic_load_n(&branch->seen, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < VM_TAG_MAX; i++) {
+        out->hits[i] = __atomic_load_n(&branch->hits[i], __ATOMIC_RELAXED);
+    }
+}
+
+vm_tag_t vm_config_num_tag(vm_config_t *config) {
+    switch (config->use_num) {
+        case VM_USE_NUM_I8: {
+            return VM_TAG_I8;
+        }
+        case VM_USE_NUM_I16: {
+            return VM_TAG_I16;
+        }
+        case VM_USE_NUM_I32: {
+            return VM_TAG_I32;
+        }
+        case VM_USE_NUM_I64: {
+            return VM_TAG_I64;
+        }
+        case VM_USE_NUM_F32: {
+            return VM_TAG_F32;
+        }
+        default: {
+            return VM_TAG_F64;
+        }
+    }
+}
+
+// succs has room for VM_TAG_MAX blocks, a version goes on to the versions
+// made so far of its continuations
+size_t vm_block_succs(vm_block_t *block, vm_block_t **succs) {
+    vm_branch_t *branch = &block->branch;
+    size_t nsuccs = 0;
+    switch (branch->op) {
+        case VM_BOP_JUMP: {
+            succs[nsuccs++] = branch->targets[0];
+            break;
+        }
+        case VM_BOP_BB:
+        case VM_BOP_BEQ:
+        case VM_BOP_BLT: {
+            succs[nsuccs++] = branch->targets[0];
+            succs[nsuccs++] = branch->targets[1];
+            break;
+        }
+        case VM_BOP_GET:
+        case VM_BOP_CALL: {
+            if (branch->tags == NULL) {
+                succs[nsuccs++] = branch->targets[0];
+                break;
+            }
+            for (size_t i = 1; i < VM_TAG_MAX; i++) {
+                vm_rblock_t *rblock = branch->rtargets[i];
+                if (rblock == NULL) {
+                    continue;
+                }
+                vm_block_t *next = vm_cache_get(rblock->block->cache, rblock);
+                if (next != NULL) {
+                    succs[nsuccs++] = next;
+                }
+            }
+            break;
+        }
+    }
+    return nsuccs;
+}
+
+static size_t vm_block_loop_walks;
+
+static void vm_block_loop_tag(vm_block_t *block, vm_block_t *head) {
+    if (block == head || head == NULL) {
+        return;
+    }
+    while (block->loop != NULL) {
+        vm_block_t *inner = block->loop;
+        if (inner == head) {
+            return;
+        }
+        if (inner->loop_pos < head->loop_pos) {
+            block->loop = head;
+            block = head;
+            head = inner;
+        } else {
+            block = inner;
+        }
+    }
+    block->loop = head;
+}
+
+static vm_block_t *vm_block_find_loops_from(vm_block_t *block, size_t walk, size_t pos) {
+    block->loop_walk = walk;
+    block->loop_pos = pos;
+    block->loop = NULL;
+    block->isloop = false;
+    block->isirr = false;
+    vm_block_t *succs[VM_TAG_MAX];
+    size_t nsuccs = vm_block_succs(block, succs);
+    for (size_t i = 0; i < nsuccs; i++) {
+        vm_block_t *next = succs[i];
+        if (next->loop_walk != walk) {
+            vm_block_loop_tag(block, vm_block_find_loops_from(next, walk, pos + 1));
+        } else if (next->loop_pos != 0) {
+            next->isloop = true;
+            vm_block_loop_tag(block, next);
+        } else if (next->loop != NULL) {
+            vm_block_t *head = next->loop;
+            if (head->loop_pos != 0) {
+                vm_block_loop_tag(block, head);
+                continue;
+            }
+            head->isirr = true;
+            while (head->loop != NULL) {
+                head = head->loop;
+                if (head->loop_pos != 0) {
+                    vm_block_loop_tag(block, head);
+                    break;
+                }
+                head->isirr = true;
+            }
+        }
+    }
+    block->loop_pos = 0;
+    return block->loop;
+}
+
+// one depth first walk that also finds irreducible loops, from "A New
+// Algorithm for Identifying Loops in Decompilation" by Wei et al.
+void vm_block_find_loops(vm_block_t *entry) {
+    vm_block_loop_walks += 1;
+    vm_block_find_loops_from(entry, vm_block_loop_walks, 1);
+}
+
+bool vm_block_in_loop(vm_block_t *block, vm_block_t *head) {
+    while (block != NULL) {
+        if (block == head) {
+            return true;
+        }
+        block = block->loop;
+    }
+    return false;
+}
+
+#define VM_BLOCK_FOLD_INT(FIELD_)                                              \
+    switch (op) {                                                                     \
+        case VM_IOP_ADD: {                                                            \
+            return !__builtin_add_overflow(lhs.value.FIELD_, rhs.value.FIELD_, &out->value.FIELD_); \
+        }                                                                             \
+        case VM_IOP_SUB: {                                                            \
+            return !__builtin_sub_overflow(lhs.value.FIELD_, rhs.value.FIELD_, &out->value.FIELD_); \
+        }                                                                             \
+        case VM_IOP_MUL: {                                                            \
+            return !__builtin_mul_overflow(lhs.value.FIELD_, rhs.value.FIELD_, &out->value.FIELD_); \
+        }                                                                             \
+        default: {                                                                    \
+            return false;                                                             \
+        }                                                                             \
+    }
+
+#define VM_BLOCK_FOLD_FLOAT(FIELD_)                                   \
+    switch (op) {                                                     \
+        case VM_IOP_ADD: {                                            \
+            out->value.FIELD_ = lhs.value.FIELD_ + rhs.value.FIELD_; \
+            return true;                                              \
+        }                                                             \
+        case VM_IOP_SUB: {                                            \
+            out->value.FIELD_ = lhs.value.FIELD_ - rhs.value.FIELD_; \
+            return true;                                              \
+        }                                                             \
+        case VM_IOP_MUL: {                                            \
+            out->value.FIELD_ = lhs.value.FIELD_ * rhs.value.FIELD_; \
+            return true;                                              \
+        }                                                             \
+        case VM_IOP_DIV: {                                            \
+            out->value.FIELD_ = lhs.value.FIELD_ / rhs.value.FIELD_; \
+            return true;                                              \
+        }                                                             \
+        default: {                                                    \
+            return false;                                             \
+        }                                                             \
+    }
+
+// math on two literals of one tag, ints that overflow are left for runtime
+// so they wrap or promote the same as they would there
+static bool vm_block_fold(uint8_t op, vm_std_value_t lhs, vm_std_value_t rhs, vm_std_value_t *out) {
+    if (lhs.tag != rhs.tag) {
+        return false;
+    }
+    out->tag = lhs.tag;
+    switch (lhs.tag) {
+        case VM_TAG_I8: {
+            VM_BLOCK_FOLD_INT(i8);
+        }
+        case VM_TAG_I16: {
+            VM_BLOCK_FOLD_INT(i16);
+        }
+        case VM_TAG_I32: {
+            VM_BLOCK_FOLD_INT(i32);
+        }
+        case VM_TAG_I64: {
+            VM_BLOCK_FOLD_INT(i64);
+        }
+        case VM_TAG_F32: {
+            VM_BLOCK_FOLD_FLOAT(f32);
+        }
+        case VM_TAG_F64: {
+            VM_BLOCK_FOLD_FLOAT(f64);
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+// what a register is known to hold, a literal or a copy of another register
+static vm_arg_t vm_block_opt_arg(vm_arg_t *known, vm_arg_t arg, bool lits) {
+    if (arg.type != VM_ARG_REG || known[arg.reg].type == VM_ARG_NONE) {
+        return arg;
+    }
+    if (known[arg.reg].type == VM_ARG_LIT && !lits) {
+        return arg;
+    }
+    return known[arg.reg];
+}
+
+static void vm_block_opt_write(vm_arg_t *known, size_t nregs, size_t reg) {
+    known[reg].type = VM_ARG_NONE;
+    for (size_t i = 0; i < nregs; i++) {
+        if (known[i].type == VM_ARG_REG && known[i].reg == reg) {
+            known[i].type = VM_ARG_NONE;
+        }
+    }
+}
+
+// constant folding and copy propagation inside one block
+static void vm_block_opt_local(vm_block_t *block) {
+    vm_arg_t *known = vm_malloc(sizeof(vm_arg_t) * (block->nregs + 1));
+    for (size_t i = 0; i < block->nregs; i++) {
+        known[i].type = VM_ARG_NONE;
+    }
+    for (size_t n = 0; n < block->len; n++) {
+        vm_instr_t *instr = &block->instrs[n];
+        for (size_t i = 0; instr->args[i].type != VM_ARG_NONE; i++) {
+            bool lits = i != 0 || (instr->op != VM_IOP_SET && instr->op != VM_IOP_LEN);
+            instr->args[i] = vm_block_opt_arg(known, instr->args[i], lits);
+        }
+        if (instr->op >= VM_IOP_ADD && instr->op <= VM_IOP_MOD && instr->args[0].type == VM_ARG_LIT && instr->args[1].type == VM_ARG_LIT) {
+            vm_std_value_t value;
+            if (vm_block_fold(instr->op, instr->args[0].lit, instr->args[1].lit, &value)) {
+                instr->op = VM_IOP_MOVE;
+                instr->args[0].lit = value;
+                instr->args[1].type = VM_ARG_NONE;
+            }
+        }
+        if (instr->out.type != VM_ARG_REG) {
+            continue;
+        }
+        vm_block_opt_write(known, block->nregs, instr->out.reg);
+        if (instr->op == VM_IOP_MOVE && (instr->args[0].type == VM_ARG_LIT || instr->args[0].type == VM_ARG_REG)) {
+            if (instr->args[0].type != VM_ARG_REG || instr->args[0].reg != instr->out.reg) {
+                known[instr->out.reg] = instr->args[0];
+            }
+        }
+    }
+    vm_branch_t *branch = &block->branch;
+    for (size_t i = 0; branch->args != NULL && branch->args[i].type != VM_ARG_NONE; i++) {
+        bool lits;
+        switch (branch->op) {
+            case VM_BOP_GET: {
+                lits = i == 1;
+                break;
+            }
+            case VM_BOP_CALL: {
+                lits = i != 0;
+                break;
+            }
+            default: {
+                lits = true;
+                break;
+            }
+        }
+        branch->args[i] = vm_block_opt_arg(known, branch->args[i], lits);
+    }
+    vm_free(known);
+}
+
+static vm_block_t *vm_block_opt_thread(vm_block_t *target, size_t nblocks) {
+    for (size_t hops = 0; hops < nblocks; hops++) {
+        if (target->len != 0 || target->branch.op != VM_BOP_JUMP || target->isfunc) {
+            break;
+        }
+        target = target->branch.targets[0];
+    }
+    return target;
+}
+
+static bool vm_block_opt_pure(uint8_t op) {
+    return op == VM_IOP_MOVE || op == VM_IOP_ADD || op == VM_IOP_SUB || op == VM_IOP_MUL || op == VM_IOP_NEW || op == VM_IOP_STD || op == VM_IOP_CLOSURE || op == VM_IOP_UPVAL;
+}
+
+// drops instructions whose register is not read again in the block or by any
+// target, targets read what is in their args
+static bool vm_block_opt_dead(vm_block_t *block) {
+    bool *live = vm_malloc(sizeof(bool) * (block->nregs + 1));
+    memset(live, 0, sizeof(bool) * (block->nregs + 1));
+    vm_branch_t *branch = &block->branch;
+    size_t ntargets = 0;
+    switch (branch->op) {
+        case VM_BOP_JUMP:
+        case VM_BOP_GET:
+        case VM_BOP_CALL: {
+            ntargets = 1;
+            break;
+        }
+        case VM_BOP_BB:
+        case VM_BOP_BEQ:
+        case VM_BOP_BLT: {
+            ntargets = 2;
+            break;
+        }
+    }
+    for (size_t t = 0; t < ntargets; t++) {
+        vm_block_t *target = branch->targets[t];
+        for (size_t i = 0; i < target->nargs; i++) {
+            if (target->args[i].reg < block->nregs) {
+                live[target->args[i].reg] = true;
+            }
+        }
+    }
+    if (branch->out.type == VM_ARG_REG) {
+        live[branch->out.reg] = false;
+    }
+    for (size_t i = 0; branch->args != NULL && branch->args[i].type != VM_ARG_NONE; i++) {
+        if (branch->args[i].type == VM_ARG_REG) {
+            live[branch->args[i].reg] = true;
+        }
+    }
+    size_t len = block->len;
+    for (size_t n = block->len; n-- > 0;) {
+        vm_instr_t instr = block->instrs[n];
+        if (instr.out.type == VM_ARG_REG) {
+            if (!live[instr.out.reg] && vm_block_opt_pure(instr.op)) {
+                block->instrs[n].op = VM_IOP_NOP;
+                continue;
+            }
+            live[instr.out.reg] = false;
+        }
+        for (size_t i = 0; instr.args[i].type != VM_ARG_NONE; i++) {
+            if (instr.args[i].type == VM_ARG_REG) {
+                live[instr.args[i].reg] = true;
+            }
+        }
+    }
+    len = 0;
+    for (size_t n = 0; n < block->len; n++) {
+        if (block->instrs[n].op != VM_IOP_NOP) {
+            block->instrs[len++] = block->instrs[n];
+        }
+    }
+    bool dropped = len != block->len;
+    block->len = len;
+    vm_free(live);
+    return dropped;
+}
+
+#define VM_BLOCK_LIVE_HAS(set_, reg_) (((set_)[(reg_) / 64] >> ((reg_) % 64)) & 1)
+#define VM_BLOCK_LIVE_ADD(set_, reg_) ((set_)[(reg_) / 64] |= (uint64_t)1 << ((reg_) % 64))
+#define VM_BLOCK_LIVE_DEL(set_, reg_) ((set_)[(reg_) / 64] &= ~((uint64_t)1 << ((reg_) % 64)))
+
+// backward liveness over the whole function, each block takes exactly the
+// registers some path reads before writing, function entries keep their
+// params since callers pass those by position
+static void vm_block_live(size_t nblocks, vm_block_t **blocks) {
+    size_t nregs = 1;
+    for (size_t i = 0; i < nblocks; i++) {
+        if (blocks[i]->id >= 0 && blocks[i]->nregs > nregs) {
+            nregs = blocks[i]->nregs;
+        }
+    }
+    size_t nwords = (nregs + 63) / 64;
+    uint64_t *sets = vm_malloc(sizeof(uint64_t) * nwords * nblocks * 3);
+    memset(sets, 0, sizeof(uint64_t) * nwords * nblocks * 3);
+    uint64_t *uses = &sets[0];
+    uint64_t *defs = &sets[nwords * nblocks];
+    uint64_t *ins = &sets[nwords * nblocks * 2];
+    size_t *npreds = vm_malloc(sizeof(size_t) * nblocks);
+    memset(npreds, 0, sizeof(size_t) * nblocks);
+    vm_block_t *succs[VM_TAG_MAX];
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->id < 0) {
+            continue;
+        }
+        uint64_t *use = &uses[nwords * i];
+        uint64_t *def = &defs[nwords * i];
+        for (size_t j = 0; j < block->len; j++) {
+            vm_instr_t *instr = &block->instrs[j];
+            for (size_t k = 0; instr->args[k].type != VM_ARG_NONE; k++) {
+                vm_arg_t arg = instr->args[k];
+                if (arg.type == VM_ARG_REG && !VM_BLOCK_LIVE_HAS(def, arg.reg)) {
+                    VM_BLOCK_LIVE_ADD(use, arg.reg);
+                }
+            }
+            if (instr->out.type == VM_ARG_REG) {
+                VM_BLOCK_LIVE_ADD(def, instr->out.reg);
+            }
+        }
+        vm_branch_t *branch = &block->branch;
+        for (size_t k = 0; branch->args[k].type != VM_ARG_NONE; k++) {
+            vm_arg_t arg = branch->args[k];
+            if (arg.type == VM_ARG_REG && !VM_BLOCK_LIVE_HAS(def, arg.reg)) {
+                VM_BLOCK_LIVE_ADD(use, arg.reg);
+            }
+        }
+        if (branch->out.type == VM_ARG_REG) {
+            VM_BLOCK_LIVE_ADD(def, branch->out.reg);
+        }
+        memcpy(&ins[nwords * i], use, sizeof(uint64_t) * nwords);
+        size_t nsuccs = vm_block_succs(block, succs);
+        for (size_t s = 0; s < nsuccs; s++) {
+            npreds[succs[s]->id] += 1;
+        }
+    }
+    size_t *pred_start = vm_malloc(sizeof(size_t) * (nblocks + 1));
+    pred_start[0] = 0;
+    for (size_t i = 0; i < nblocks; i++) {
+        pred_start[i + 1] = pred_start[i] + npreds[i];
+        npreds[i] = 0;
+    }
+    size_t *preds = vm_malloc(sizeof(size_t) * (pred_start[nblocks] + 1));
+    for (size_t i = 0; i < nblocks; i++) {
+        if (blocks[i]->id < 0) {
+            continue;
+        }
+        size_t nsuccs = vm_block_succs(blocks[i], succs);
+        for (size_t s = 0; s < nsuccs; s++) {
+            size_t id = (size_t)succs[s]->id;
+            preds[pred_start[id] + npreds[id]++] = i;
+        }
+    }
+    size_t *work = vm_malloc(sizeof(size_t) * (nblocks + 1));
+    bool *queued = vm_malloc(sizeof(bool) * (nblocks + 1));
+    size_t nwork = 0;
+    for (size_t i = 0; i < nblocks; i++) {
+        queued[i] = blocks[i]->id >= 0;
+        if (queued[i]) {
+            work[nwork++] = i;
+        }
+    }
+    uint64_t *out = vm_malloc(sizeof(uint64_t) * nwords);
+    while (nwork > 0) {
+        size_t i = work[--nwork];
+        queued[i] = false;
+        memset(out, 0, sizeof(uint64_t) * nwords);
+        size_t nsuccs = vm_block_succs(blocks[i], succs);
+        for (size_t s = 0; s < nsuccs; s++) {
+            uint64_t *in = &ins[nwords * (size_t)succs[s]->id];
+            for (size_t w = 0; w < nwords; w++) {
+                out[w] |= in[w];
+            }
+        }
+        bool changed = false;
+        uint64_t *in = &ins[nwords * i];
+        uint64_t *use = &uses[nwords * i];
+        uint64_t *def = &defs[nwords * i];
+        for (size_t w = 0; w < nwords; w++) {
+            uint64_t next = use[w] | (out[w] & ~def[w]);
+            if (next != in[w]) {
+                in[w] = next;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            continue;
+        }
+        for (size_t p = pred_start[i]; p < pred_start[i + 1]; p++) {
+            if (!queued[preds[p]]) {
+                queued[preds[p]] = true;
+                work[nwork++] = preds[p];
+            }
+        }
+    }
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->id < 0 || block->isfunc) {
+            continue;
+        }
+        uint64_t *in = &ins[nwords * i];
+        size_t nargs = 0;
+        for (size_t reg = 0; reg < nregs; reg++) {
+            if (VM_BLOCK_LIVE_HAS(in, reg)) {
+                nargs += 1;
+            }
+        }
+        // registers made by later passes can make a block take more args
+        if (nargs > block->nargs) {
+            block->args = vm_realloc(block->args, sizeof(vm_arg_t) * nargs);
+        }
+        nargs = 0;
+        for (size_t reg = 0; reg < nregs; reg++) {
+            if (VM_BLOCK_LIVE_HAS(in, reg)) {
+                block->args[nargs++] = (vm_arg_t){
+                    .type = VM_ARG_REG,
+                    .reg = (uint32_t)reg,
+                };
+            }
+        }
+        block->nargs = nargs;
+    }
+    vm_free(out);
+    vm_free(queued);
+    vm_free(work);
+    vm_free(preds);
+    vm_free(pred_start);
+    vm_free(npreds);
+    vm_free(sets);
+}
+
+static bool vm_block_opt_key(vm_arg_t arg) {
+    return arg.type == VM_ARG_LIT && arg.lit.tag == VM_TAG_STR;
+}
+
+static bool vm_block_opt_alias(size_t nregs, uint32_t *regs, vm_arg_t arg) {
+    if (arg.type != VM_ARG_REG) {
+        return false;
+    }
+    for (size_t i = 0; i < nregs; i++) {
+        if (regs[i] == arg.reg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// marks in reach every block control can get to from block without a call
+static void vm_block_opt_reach(size_t nblocks, vm_block_t *block, bool *reach) {
+    memset(reach, 0, sizeof(bool) * nblocks);
+    vm_block_t **stack = vm_malloc(sizeof(vm_block_t *) * (nblocks + 1));
+    vm_block_t *succs[VM_TAG_MAX];
+    size_t nstack = 0;
+    reach[block->id] = true;
+    stack[nstack++] = block;
+    while (nstack > 0) {
+        vm_block_t *cur = stack[--nstack];
+        size_t nsuccs = vm_block_succs(cur, succs);
+        for (size_t i = 0; i < nsuccs; i++) {
+            if (!reach[succs[i]->id]) {
+                reach[succs[i]->id] = true;
+                stack[nstack++] = succs[i];
+            }
+        }
+    }
+    vm_free(stack);
+}
+
+// keeps what vm_block_info made true, a block has at least the registers of
+// the blocks it branches to, the jit sizes a region by its entry
+static void vm_block_opt_nregs(size_t nblocks, vm_block_t **blocks) {
+    vm_block_t *succs[VM_TAG_MAX];
+    bool redo = true;
+    while (redo) {
+        redo = false;
+        for (ptrdiff_t i = (ptrdiff_t)nblocks - 1; i >= 0; i--) {
+            vm_block_t *block = blocks[i];
+            if (block->id < 0) {
+                continue;
+            }
+            size_t nsuccs = vm_block_succs(block, succs);
+            for (size_t j = 0; j < nsuccs; j++) {
+                if (succs[j]->nregs > block->nregs) {
+                    block->nregs = succs[j]->nregs;
+                    redo = true;
+                }
+            }
+        }
+    }
+}
+
+// a set or get of a literal string key on the table, what stays virtual
+static bool vm_block_opt_field(size_t nalias, uint32_t *alias, vm_block_t *cur, size_t j) {
+    if (j < cur->len) {
+        vm_arg_t *args = cur->instrs[j].args;
+        return cur->instrs[j].op == VM_IOP_SET && vm_block_opt_alias(nalias, alias, args[0]) && vm_block_opt_key(args[1]) && !vm_block_opt_alias(nalias, alias, args[2]);
+    }
+    vm_arg_t *args = cur->branch.args;
+    return cur->branch.op == VM_BOP_GET && vm_block_opt_alias(nalias, alias, args[0]) && vm_block_opt_key(args[1]);
+}
+
+// any other read of the table, it has to be a real one there
+static bool vm_block_opt_escape(size_t nalias, uint32_t *alias, vm_block_t *cur, size_t j) {
+    if (vm_block_opt_field(nalias, alias, cur, j)) {
+        return false;
+    }
+    vm_arg_t *args = j < cur->len ? cur->instrs[j].args : cur->branch.args;
+    for (size_t k = 0; args[k].type != VM_ARG_NONE; k++) {
+        if (vm_block_opt_alias(nalias, alias, args[k])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// makes the table real from its key registers, a new, a set of each key
+// that was ever set, and a move into each copy made so far
+static size_t vm_block_opt_materialize(vm_instr_t *instrs, size_t len, size_t ncopies, uint32_t *alias, size_t nkeys, const char **keys, bool *sets, size_t base) {
+    vm_arg_t *none = vm_malloc(sizeof(vm_arg_t));
+    none[0].type = VM_ARG_NONE;
+    instrs[len++] = (vm_instr_t){
+        .op = VM_IOP_NEW,
+        .out = (vm_arg_t){
+            .type = VM_ARG_REG,
+            .reg = alias[0],
+        },
+        .args = none,
+    };
+    for (size_t a = 1; a < ncopies; a++) {
+        vm_arg_t *move = vm_malloc(sizeof(vm_arg_t) * 2);
+        move[0] = (vm_arg_t){
+            .type = VM_ARG_REG,
+            .reg = alias[0],
+        };
+        move[1].type = VM_ARG_NONE;
+        instrs[len++] = (vm_instr_t){
+            .op = VM_IOP_MOVE,
+            .out = (vm_arg_t){
+                .type = VM_ARG_REG,
+                .reg = alias[a],
+            },
+            .args = move,
+        };
+    }
+    for (size_t k = 0; k < nkeys; k++) {
+        if (!sets[k]) {
+            continue;
+        }
+        vm_arg_t *set = vm_malloc(sizeof(vm_arg_t) * 4);
+        set[0] = (vm_arg_t){
+            .type = VM_ARG_REG,
+            .reg = alias[0],
+        };
+        set[1] = (vm_arg_t){
+            .type = VM_ARG_LIT,
+            .lit.tag = VM_TAG_STR,
+            .lit.value.str = keys[k],
+        };
+        set[2] = (vm_arg_t){
+            .type = VM_ARG_REG,
+            .reg = (uint32_t)(base + k),
+        };
+        set[3].type = VM_ARG_NONE;
+        instrs[len++] = (vm_instr_t){
+            .op = VM_IOP_SET,
+            .out = (vm_arg_t){
+                .type = VM_ARG_NONE,
+            },
+            .args = set,
+        };
+    }
+    return len;
+}
+
+// a table from new stays virtual, one register per literal string key it is
+// set or read with, until the first other use on a path, there it is made a
+// real table with what was set so far, a block that another path enters with
+// the real table gets it from every path, copies of the table made right after
+// the new in its block are followed, and no other path into those blocks can
+// bring a different value in that register
+static bool vm_block_opt_sra(size_t nblocks, vm_block_t **blocks, vm_block_t *block, size_t n) {
+    size_t nalias = 1;
+    uint32_t *alias = vm_malloc(sizeof(uint32_t) * (block->len + 1));
+    alias[0] = block->instrs[n].out.reg;
+    bool *copies = vm_malloc(sizeof(bool) * (block->len + 1));
+    memset(copies, 0, sizeof(bool) * (block->len + 1));
+    copies[n] = true;
+    for (size_t j = n + 1; j < block->len; j++) {
+        vm_instr_t *instr = &block->instrs[j];
+        if (instr->op == VM_IOP_MOVE && vm_block_opt_alias(nalias, alias, instr->args[0]) && !vm_block_opt_alias(nalias, alias, instr->out)) {
+            alias[nalias++] = instr->out.reg;
+            copies[j] = true;
+        }
+    }
+    bool *reach = vm_malloc(sizeof(bool) * nblocks);
+    vm_block_opt_reach(nblocks, block, reach);
+    vm_block_t *succs[VM_TAG_MAX];
+    bool ok = true;
+    for (size_t a = 0; a < block->nargs; a++) {
+        if (vm_block_opt_alias(nalias, alias, block->args[a])) {
+            ok = false;
+        }
+    }
+    // live blocks take the table in, esc is where it is first used for real
+    bool *live = vm_malloc(sizeof(bool) * nblocks);
+    size_t *esc = vm_malloc(sizeof(size_t) * nblocks);
+    for (size_t i = 0; ok && i < nblocks; i++) {
+        vm_block_t *cur = blocks[i];
+        live[i] = false;
+        esc[i] = SIZE_MAX;
+        if (cur->id < 0) {
+            continue;
+        }
+        if (!reach[i]) {
+            size_t nsuccs = vm_block_succs(cur, succs);
+            for (size_t j = 0; j < nsuccs; j++) {
+                if (!reach[succs[j]->id]) {
+                    continue;
+                }
+                for (size_t a = 0; a < succs[j]->nargs; a++) {
+                    if (vm_block_opt_alias(nalias, alias, succs[j]->args[a])) {
+                        ok = false;
+                    }
+                }
+            }
+            continue;
+        }
+        for (size_t a = 0; a < cur->nargs; a++) {
+            if (vm_block_opt_alias(nalias, alias, cur->args[a])) {
+                live[i] = true;
+            }
+        }
+        for (size_t j = 0; ok && j < cur->len; j++) {
+            if (cur == block && copies[j]) {
+                continue;
+            }
+            if (vm_block_opt_alias(nalias, alias, cur->instrs[j].out)) {
+                ok = false;
+            }
+        }
+        if (vm_block_opt_alias(nalias, alias, cur->branch.out)) {
+            ok = false;
+        }
+        for (size_t j = cur == block ? n + 1 : 0; esc[i] == SIZE_MAX && j <= cur->len; j++) {
+            if ((j == cur->len || cur != block || !copies[j]) && vm_block_opt_escape(nalias, alias, cur, j)) {
+                esc[i] = j;
+            }
+        }
+    }
+    // the table is real on entry to a block if it is real leaving any block
+    // before it, and real leaving a block that uses it for real or goes to
+    // one it is real in, so no block is entered with it both ways
+    bool *real_in = vm_malloc(sizeof(bool) * nblocks);
+    bool *real_out = vm_malloc(sizeof(bool) * nblocks);
+    memset(real_in, 0, sizeof(bool) * nblocks);
+    memset(real_out, 0, sizeof(bool) * nblocks);
+    bool redo = ok;
+    while (redo) {
+        redo = false;
+        for (size_t i = 0; i < nblocks; i++) {
+            vm_block_t *cur = blocks[i];
+            if (cur->id < 0 || !reach[i] || real_out[i]) {
+                continue;
+            }
+            bool real = (cur != block && real_in[i]) || esc[i] != SIZE_MAX;
+            size_t nsuccs = vm_block_succs(cur, succs);
+            for (size_t j = 0; j < nsuccs; j++) {
+                if (live[succs[j]->id] && real_in[succs[j]->id]) {
+                    real = true;
+                }
+            }
+            if (!real) {
+                continue;
+            }
+            real_out[i] = true;
+            redo = true;
+            for (size_t j = 0; j < nsuccs; j++) {
+                if (live[succs[j]->id]) {
+                    real_in[succs[j]->id] = true;
+                }
+            }
+        }
+    }
+    // only worth it when some path keeps it virtual to its end
+    bool virt = false;
+    for (size_t i = 0; ok && i < nblocks; i++) {
+        if (blocks[i]->id >= 0 && reach[i] && !real_out[i] && (blocks[i] == block || live[i])) {
+            virt = true;
+        }
+    }
+    ok = ok && virt;
+    // lambda bodies are numbered in the middle of the function around them,
+    // so the owner is the entry that reaches the block, and the new registers
+    // go past every register any block of it uses
+    bool *mine = vm_malloc(sizeof(bool) * nblocks);
+    vm_block_t *func = NULL;
+    for (size_t i = 0; ok && func == NULL && i < nblocks; i++) {
+        if (blocks[i]->id < 0 || (i != 0 && !blocks[i]->isfunc)) {
+            continue;
+        }
+        vm_block_opt_reach(nblocks, blocks[i], mine);
+        if (mine[block->id]) {
+            func = blocks[i];
+        }
+    }
+    ok = ok && func != NULL;
+    size_t base = 0;
+    for (size_t i = 0; ok && i < nblocks; i++) {
+        if (mine[i] && blocks[i]->nregs > base) {
+            base = blocks[i]->nregs;
+        }
+    }
+    size_t nkeys = 0;
+    const char **keys = NULL;
+    bool *sets = NULL;
+    for (size_t i = 0; ok && i < nblocks; i++) {
+        vm_block_t *cur = blocks[i];
+        if (cur->id < 0 || !reach[i] || (cur != block && (!live[i] || real_in[i]))) {
+            continue;
+        }
+        for (size_t j = cur == block ? n + 1 : 0; j <= cur->len && j < esc[i]; j++) {
+            if (!vm_block_opt_field(nalias, alias, cur, j)) {
+                continue;
+            }
+            const char *key = (j < cur->len ? cur->instrs[j].args : cur->branch.args)[1].lit.value.str;
+            size_t k = 0;
+            while (k < nkeys && strcmp(keys[k], key) != 0) {
+                k += 1;
+            }
+            if (k == nkeys) {
+                keys = vm_realloc(keys, sizeof(const char *) * (nkeys + 1));
+                sets = vm_realloc(sets, sizeof(bool) * (nkeys + 1));
+                keys[nkeys] = key;
+                sets[nkeys++] = false;
+            }
+            if (j < cur->len) {
+                sets[k] = true;
+            }
+        }
+    }
+    for (size_t i = 0; ok && i < nblocks; i++) {
+        vm_block_t *cur = blocks[i];
+        if (cur->id < 0 || !reach[i] || (cur != block && (!live[i] || real_in[i]))) {
+            continue;
+        }
+        vm_instr_t *instrs = vm_malloc(sizeof(vm_instr_t) * (cur->len + nkeys * 2 + nalias + 2));
+        size_t len = 0;
+        bool real = false;
+        size_t ncopies = cur == block ? 0 : nalias;
+        for (size_t j = 0; j < cur->len; j++) {
+            vm_instr_t instr = cur->instrs[j];
+            if (cur == block && j < n) {
+                instrs[len++] = instr;
+                continue;
+            }
+            if (cur == block && j == n) {
+                vm_free(instr.args);
+                for (size_t k = 0; k < nkeys; k++) {
+                    vm_arg_t *nil = vm_malloc(sizeof(vm_arg_t) * 2);
+                    nil[0] = (vm_arg_t){
+                        .type = VM_ARG_LIT,
+                        .lit.tag = VM_TAG_NIL,
+                    };
+                    nil[1].type = VM_ARG_NONE;
+                    instrs[len++] = (vm_instr_t){
+                        .op = VM_IOP_MOVE,
+                        .out = (vm_arg_t){
+                            .type = VM_ARG_REG,
+                            .reg = (uint32_t)(base + k),
+                        },
+                        .args = nil,
+                    };
+                }
+                ncopies = 1;
+                continue;
+            }
+            if (!real && j == esc[i]) {
+                len = vm_block_opt_materialize(instrs, len, ncopies, alias, nkeys, keys, sets, base);
+                real = true;
+            }
+            if (cur == block && copies[j]) {
+                ncopies += 1;
+                if (!real) {
+                    vm_free(instr.args);
+                    continue;
+                }
+            }
+            if (!real && vm_block_opt_field(nalias, alias, cur, j)) {
+                size_t k = 0;
+                while (strcmp(keys[k], instr.args[1].lit.value.str) != 0) {
+                    k += 1;
+                }
+                instr.op = VM_IOP_MOVE;
+                instr.out = (vm_arg_t){
+                    .type = VM_ARG_REG,
+                    .reg = (uint32_t)(base + k),
+                };
+                instr.args[0] = instr.args[2];
+                instr.args[1].type = VM_ARG_NONE;
+            }
+            instrs[len++] = instr;
+        }
+        vm_branch_t *branch = &cur->branch;
+        if (!real && esc[i] == cur->len) {
+            len = vm_block_opt_materialize(instrs, len, ncopies, alias, nkeys, keys, sets, base);
+            real = true;
+        }
+        if (!real && vm_block_opt_field(nalias, alias, cur, cur->len)) {
+            size_t k = 0;
+            while (strcmp(keys[k], branch->args[1].lit.value.str) != 0) {
+                k += 1;
+            }
+            vm_arg_t *move = vm_malloc(sizeof(vm_arg_t) * 2);
+            move[0] = (vm_arg_t){
+                .type = VM_ARG_REG,
+                .reg = (uint32_t)(base + k),
+            };
+            move[1].type = VM_ARG_NONE;
+            instrs[len++] = (vm_instr_t){
+                .op = VM_IOP_MOVE,
+                .out = branch->out,
+                .args = move,
+            };
+            branch->op = VM_BOP_JUMP;
+            branch->out.type = VM_ARG_NONE;
+            branch->args[0].type = VM_ARG_NONE;
+        }
+        if (!real && real_out[i]) {
+            len = vm_block_opt_materialize(instrs, len, ncopies, alias, nkeys, keys, sets, base);
+        }
+        vm_free(cur->instrs);
+        cur->instrs = instrs;
+        cur->len = len;
+        cur->alloc = len;
+    }
+    if (ok) {
+        for (size_t i = 0; i < nblocks; i++) {
+            if (blocks[i]->id >= 0 && reach[i] && blocks[i]->nregs < base + nkeys) {
+                blocks[i]->nregs = base + nkeys;
+            }
+        }
+        vm_block_opt_nregs(nblocks, blocks);
+    }
+    vm_free(sets);
+    vm_free(keys);
+    vm_free(mine);
+    vm_free(real_out);
+    vm_free(real_in);
+    vm_free(esc);
+    vm_free(live);
+    vm_free(reach);
+    vm_free(copies);
+    vm_free(alias);
+    return ok;
+}
+
+// the tag an arg has just before instruction n of the block, when the last
+// write to it in the block fixes one
+static vm_tag_t vm_block_opt_def_tag(vm_block_t *block, size_t n, vm_arg_t arg) {
+    switch (arg.type) {
+        case VM_ARG_LIT: {
+            return arg.lit.tag;
+        }
+        case VM_ARG_FUN: {
+            return VM_TAG_FUN;
+        }
+        case VM_ARG_REG: {
+            break;
+        }
+        default: {
+            return VM_TAG_UNK;
+        }
+    }
+    for (size_t j = n; j-- > 0;) {
+        vm_instr_t *instr = &block->instrs[j];
+        if (instr->out.type != VM_ARG_REG || instr->out.reg != arg.reg) {
+            continue;
+        }
+        switch (instr->op) {
+            case VM_IOP_NEW:
+            case VM_IOP_STD: {
+                return VM_TAG_TAB;
+            }
+            case VM_IOP_CLOSURE: {
+                return VM_TAG_CLOSURE;
+            }
+            case VM_IOP_UPVAL: {
+                return instr->tag;
+            }
+            case VM_IOP_MOVE: {
+                return vm_block_opt_def_tag(block, j, instr->args[0]);
+            }
+            default: {
+                return VM_TAG_UNK;
+            }
+        }
+    }
+    return VM_TAG_UNK;
+}
+
+static void vm_block_opt_count_funs(size_t *uses, vm_arg_t *args) {
+    for (size_t i = 0; args[i].type != VM_ARG_NONE; i++) {
+        if (args[i].type == VM_ARG_FUN) {
+            uses[args[i].func->id] += 1;
+        }
+    }
+}
+
+// a body made by one closure instruction knows the tag of each capture that
+// has one where the closure is made, those are read with upval, or moved in
+// when they are constant, instead of a get that ends the block to dispatch
+static bool vm_block_opt_upvals(size_t nblocks, vm_block_t **blocks) {
+    size_t *uses = vm_malloc(sizeof(size_t) * (nblocks + 1));
+    memset(uses, 0, sizeof(size_t) * (nblocks + 1));
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->id < 0) {
+            continue;
+        }
+        for (size_t j = 0; j < block->len; j++) {
+            vm_block_opt_count_funs(uses, block->instrs[j].args);
+        }
+        vm_block_opt_count_funs(uses, block->branch.args);
+    }
+    bool *reach = vm_malloc(sizeof(bool) * (nblocks + 1));
+    vm_block_t **stack = vm_malloc(sizeof(vm_block_t *) * (nblocks + 1));
+    vm_block_t *succs[VM_TAG_MAX];
+    bool changed = false;
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->id < 0) {
+            continue;
+        }
+        for (size_t n = 0; n < block->len; n++) {
+            vm_instr_t *closure = &block->instrs[n];
+            if (closure->op != VM_IOP_CLOSURE || uses[closure->args[0].func->id] != 1) {
+                continue;
+            }
+            size_t nslots = 0;
+            while (closure->args[nslots].type != VM_ARG_NONE) {
+                nslots += 1;
+            }
+            memset(reach, 0, sizeof(bool) * (nblocks + 1));
+            size_t nstack = 0;
+            vm_block_t *body = closure->args[0].func;
+            reach[body->id] = true;
+            stack[nstack++] = body;
+            bool ok = true;
+            while (nstack > 0) {
+                vm_block_t *cur = stack[--nstack];
+                for (size_t j = 0; j < cur->len; j++) {
+                    if (cur->instrs[j].out.type == VM_ARG_REG && cur->instrs[j].out.reg == 0) {
+                        ok = false;
+                    }
+                }
+                if (cur->branch.out.type == VM_ARG_REG && cur->branch.out.reg == 0) {
+                    ok = false;
+                }
+                size_t nsuccs = vm_block_succs(cur, succs);
+                for (size_t s = 0; s < nsuccs; s++) {
+                    if (!reach[succs[s]->id]) {
+                        reach[succs[s]->id] = true;
+                        stack[nstack++] = succs[s];
+                    }
+                }
+            }
+            for (size_t j = 0; ok && j < nblocks; j++) {
+                vm_block_t *cur = blocks[j];
+                vm_branch_t *branch = &cur->branch;
+                if (cur->id < 0 || !reach[j] || branch->op != VM_BOP_GET) {
+                    continue;
+                }
+                vm_arg_t obj = branch->args[0];
+                vm_arg_t key = branch->args[1];
+                if (obj.type != VM_ARG_REG || obj.reg != 0 || key.type != VM_ARG_LIT || key.lit.tag != VM_TAG_I32) {
+                    continue;
+                }
+                int32_t slot = key.lit.value.i32;
+                if (slot < 1 || (size_t)slot >= nslots) {
+                    continue;
+                }
+                vm_arg_t cap = closure->args[slot];
+                vm_tag_t tag = vm_block_opt_def_tag(block, n, cap);
+                if (tag == VM_TAG_UNK) {
+                    continue;
+                }
+                vm_arg_t *args = vm_malloc(sizeof(vm_arg_t) * 3);
+                vm_instr_t load;
+                if (cap.type == VM_ARG_REG) {
+                    args[0] = obj;
+                    args[1] = key;
+                    args[2].type = VM_ARG_NONE;
+                    load = (vm_instr_t){
+                        .op = VM_IOP_UPVAL,
+                        .tag = tag,
+                        .out = branch->out,
+                        .args = args,
+                    };
+                } else {
+                    args[0] = cap;
+                    args[1].type = VM_ARG_NONE;
+                    load = (vm_instr_t){
+                        .op = VM_IOP_MOVE,
+                        .out = branch->out,
+                        .args = args,
+                    };
+                }
+                cur->instrs = vm_realloc(cur->instrs, sizeof(vm_instr_t) * (cur->len + 1));
+                cur->alloc = cur->len + 1;
+                cur->instrs[cur->len++] = load;
+                if (cur == block) {
+                    closure = &block->instrs[n];
+                }
+                branch->op = VM_BOP_JUMP;
+                branch->out.type = VM_ARG_NONE;
+                branch->args[0].type = VM_ARG_NONE;
+                changed = true;
+            }
+        }
+    }
+    vm_free(stack);
+    vm_free(reach);
+    vm_free(uses);
+    return changed;
+}
+
+// dropping dead code and shrinking args feed each other, so both repeat
+// until neither finds more
+static void vm_block_opt_clean(size_t nblocks, vm_block_t **blocks) {
+    bool redo = true;
+    while (redo) {
+        redo = false;
+        vm_block_live(nblocks, blocks);
+        for (size_t i = 0; i < nblocks; i++) {
+            if (blocks[i]->id >= 0 && vm_block_opt_dead(blocks[i])) {
+                redo = true;
+            }
+        }
+    }
+}
+
+// runs after vm_block_info, so every block already has its args and nregs
+void vm_block_opt(size_t nblocks, vm_block_t **blocks) {
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->id < 0) {
+            continue;
+        }
+        vm_block_opt_local(block);
+        switch (block->branch.op) {
+            case VM_BOP_JUMP:
+            case VM_BOP_GET:
+            case VM_BOP_CALL: {
+                block->branch.targets[0] = vm_block_opt_thread(block->branch.targets[0], nblocks);
+                break;
+            }
+            case VM_BOP_BB:
+            case VM_BOP_BEQ:
+            case VM_BOP_BLT: {
+                block->branch.targets[0] = vm_block_opt_thread(block->branch.targets[0], nblocks);
+                block->branch.targets[1] = vm_block_opt_thread(block->branch.targets[1], nblocks);
+                break;
+            }
+        }
+    }
+    vm_block_opt_clean(nblocks, blocks);
+    bool redo = vm_block_opt_upvals(nblocks, blocks);
+    for (size_t i = 0; i < nblocks; i++) {
+        vm_block_t *block = blocks[i];
+        if (block->id < 0) {
+            continue;
+        }
+        for (size_t j = 0; j < block->len; j++) {
+            if (block->instrs[j].op == VM_IOP_NEW && vm_block_opt_sra(nblocks, blocks, block, j)) {
+                redo = true;
+            }
+        }
+    }
+    if (redo) {
+        for (size_t i = 0; i < nblocks; i++) {
+            if (blocks[i]->id >= 0) {
+                vm_block_opt_local(blocks[i]);
+            }
+        }
+        vm_block_opt_clean(nblocks, blocks);
+    }
+}
@@ -6,6 +6,9 @@
 #include "std/std.h"
 #include "tag.h"
 
+// call sites guard on at most this many callees before using the call table
+#define VM_BRANCH_CALLEES 4
+
 struct vm_arg_t;
 struct vm_branch_t;
 struct vm_instr_t;
@@ -62,6 +65,10 @@ enum {
     VM_IOP_LEN,
     // objects
     VM_IOP_STD,
+    // closures: a function with its captures, and a capture by slot whose
+    // tag is known when the ir is built, in instr.tag
+    VM_IOP_CLOSURE,
+    VM_IOP_UPVAL,
 };
 
 struct vm_rblock_t {
@@ -74,13 +81,27 @@ struct vm_rblock_t {
     size_t least_faults;
     size_t base_redo;
     size_t redo;
+    // places that hold a copy of jit, for the backend to repoint
+    struct {
+        size_t len;
+        void ***ptr;
+        size_t alloc;
+    } uses;
+    // jit as a backend symbol, made by the first direct call to it
+    void *sym;
 };
 
 struct vm_cache_t {
     vm_rblock_t **keys;
     void **values;
+    // first VM_CACHE_SIG_TAGS arg tags of each key, packed four bits each
+    uint64_t *sigs;
+    uint64_t *hashes;
     size_t len;
     size_t alloc;
+    // open addressed, entry + 1 by hash, 0 is empty
+    uint32_t *index;
+    uint32_t index_alloc;
 };
 
 struct vm_arg_t {
@@ -103,6 +124,17 @@ struct vm_branch_t {
     };
     vm_arg_t *args;
     vm_arg_t out;
+    // GET and CALL: register tags before out is written, rtargets are made from
+    // these on the first value of each tag
+    vm_tags_t *tags;
+    // GET and CALL: one bit per tag out has held at runtime
+    uint32_t seen;
+    // GET and CALL: times out has held each tag, stops at UINT16_MAX
+    uint16_t hits[VM_TAG_MAX];
+    // CALL: ids of the functions called, more than VM_BRANCH_CALLEES of them
+    // makes the site megamorphic
+    int32_t callees[VM_BRANCH_CALLEES];
+    uint8_t ncallees;
     struct {
         vm_rblock_t **call_table;
         void **jump_table;
@@ -135,11 +167,30 @@ struct vm_block_t {
     vm_cache_t *cache;
     void *pass;
 
+    // versions: the block this is a version of, and register tags on entry
+    vm_block_t *base;
+    vm_tags_t *tags;
+    // versions: by instruction, the rest of the block to leave to when that
+    // instruction overflows, versioned and compiled the first time it does
+    vm_rblock_t **tails;
+    // by instruction, the block of what follows it, the tails of every
+    // version are versions of these and share this block's cache
+    vm_block_t **rests;
+
+    // set by vm_block_find_loops: the header of the innermost loop holding
+    // this block, a header holds itself so this is the loop around it
+    vm_block_t *loop;
+    size_t loop_walk;
+    size_t loop_pos;
+
     int64_t label : 60;
     bool isfunc : 1;
     bool mark : 1;
     bool checked : 1;
     bool check : 1;
+    bool isloop : 1;
+    // a loop that can be entered other than through its header
+    bool isirr : 1;
 };
 
 void vm_block_realloc(vm_block_t *block, vm_instr_t instr);
@@ -152,7 +203,16 @@ void vm_print_block(FILE *out, vm_block_t *val);
 void vm_print_blocks(FILE *out, size_t nblocks, vm_block_t **val);
 
 void vm_block_info(size_t nblocks, vm_block_t **blocks);
+void vm_block_opt(size_t nblocks, vm_block_t **blocks);
 vm_tag_t vm_arg_to_tag(vm_arg_t arg);
+void vm_branch_add_callee(vm_branch_t *branch, int32_t id);
+void vm_branch_add_seen(vm_branch_t *branch, vm_tag_t tag);
+// a consistent copy of what the interpreter has profiled so far
+void vm_branch_copy_profile(vm_branch_t *out, vm_branch_t *branch);
+vm_tag_t vm_config_num_tag(vm_config_t *config);
+size_t vm_block_succs(vm_block_t *block, vm_block_t **succs);
+void vm_block_find_loops(vm_block_t *entry);
+bool vm_block_in_loop(vm_block_t *block, vm_block_t *head);
 
 #define vm_arg_nil() ((vm_arg_t) { .type = (VM_ARG_LIT), .lit.tag = (VM_TAG_NIL) })
 
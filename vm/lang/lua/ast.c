@@ -17,7 +17,7 @@ char *vm_lang_lua_src(vm_lang_lua_t src, TSNode node) {
     uint32_t start = ts_node_start_byte(node);
     uint32_t end = ts_node_end_byte(node);
     uint32_t len = end - start;
-    char *ident = vm_malloc(sizeof(char) * (len + 1));
+    char *ident = vm_malloc_atomic(sizeof(char) * (len + 1));
     for (size_t i = 0; i < len; i++) {
         ident[i] = src.src[start + i];
     }
@@ -25,6 +25,12 @@ char *vm_lang_lua_src(vm_lang_lua_t src, TSNode node) {
     return ident;
 }
 
+const char *vm_lang_lua_src_intern(vm_lang_lua_t src, TSNode node) {
+    uint32_t start = ts_node_start_byte(node);
+    uint32_t end = ts_node_end_byte(node);
+    return vm_string_intern(&src.src[start], end - start);
+}
+
 vm_ast_node_t vm_lang_lua_gensym(vm_lang_lua_t src) {
     char buf[32];
     snprintf(buf, 31, "gensym.%zu", *src.nsyms);
@@ -183,9 +189,13 @@ vm_ast_node_t vm_lang_lua_conv(vm_lang_lua_t src, TSNode node) {
         }
         return vm_ast_build_nil();
     }
+    if (!strcmp(type, "unary_expression") && !strcmp(ts_node_type(ts_node_child(node, 0)), "#")) {
+        vm_ast_node_t right = vm_lang_lua_conv(src, ts_node_child(node, 1));
+        return vm_ast_build_len(right);
+    }
     if (!strcmp(type, "string")) {
         TSNode content = ts_node_child(node, 1);
-        return vm_ast_build_literal(str, vm_lang_lua_src(src, content));
+        return vm_ast_build_literal(str, vm_lang_lua_src_intern(src, content));
     }
     if (!strcmp(type, "number")) {
         switch (src.config->use_num) {
@@ -225,7 +235,7 @@ vm_ast_node_t vm_lang_lua_conv(vm_lang_lua_t src, TSNode node) {
         TSNode func_node = ts_node_child(node, 0);
         if (!strcmp(ts_node_type(func_node), "method_index_expression")) {
             vm_ast_node_t obj = vm_lang_lua_conv(src, ts_node_child(func_node, 0));
-            vm_ast_node_t index = vm_ast_build_literal(str, vm_lang_lua_src(src, ts_node_child(func_node, 2)));
+            vm_ast_node_t index = vm_ast_build_literal(str, vm_lang_lua_src_intern(src, ts_node_child(func_node, 2)));
             vm_ast_node_t func = vm_ast_build_load(obj, index);
             TSNode args_node = ts_node_child(node, 1);
             size_t nargs = ts_node_child_count(args_node);
@@ -295,7 +305,7 @@ vm_ast_node_t vm_lang_lua_conv(vm_lang_lua_t src, TSNode node) {
     }
     if (!strcmp(type, "dot_index_expression")) {
         vm_ast_node_t table = vm_lang_lua_conv(src, ts_node_child(node, 0));
-        char *field = vm_lang_lua_src(src, ts_node_child(node, 2));
+        const char *field = vm_lang_lua_src_intern(src, ts_node_child(node, 2));
         return vm_ast_build_load(table, vm_ast_build_literal(str, field));
     }
     printf("str = %s\n", ts_node_string(node));
@@ -35,24 +35,52 @@
     exit(1);
 #endif
 
-#if VM_USE_LEAKS == VM_USE_LEAKS_BDWGC
 void GC_init();
 void *GC_malloc(size_t size);
+void *GC_malloc_atomic(size_t size);
 void *GC_realloc(void *ptr, size_t size);
 void GC_free(void *ptr);
 
-#define vm_init_mem() (GC_init())
-#define vm_malloc(x) (GC_malloc(x))
-#define vm_realloc(x, y) (GC_realloc(x, y))
-#define vm_free(x) (GC_free(x))
-#endif
+// one of VM_USE_LEAKS_*, set by vm_init_mem before anything is allocated.
+// with tgc, tables and closures are collected by vm/gc.c and everything else
+// is freed by hand
+extern uint8_t vm_mem_gc;
 
-#if VM_USE_LEAKS == VM_USE_LEAKS_NOGC
-#define vm_init_mem() ((void)0)
-#define vm_malloc(x) (malloc((x)))
-#define vm_realloc(x, y) (realloc((x), (y)))
-#define vm_free(x) ((void)((x)))
-#endif
+void vm_mem_init(uint8_t gc, void *stack_base);
+
+// the frame of the caller is the top of the stack vm/gc.c scans
+#define vm_init_mem(gc_) (vm_mem_init((gc_), __builtin_frame_address(0)))
+
+static inline void *vm_malloc(size_t size) {
+    if (vm_mem_gc == VM_USE_LEAKS_BDWGC) {
+        return GC_malloc(size);
+    }
+    return malloc(size);
+}
+
+// for memory that never holds a pointer, so bdwgc does not scan it
+static inline void *vm_malloc_atomic(size_t size) {
+    if (vm_mem_gc == VM_USE_LEAKS_BDWGC) {
+        return GC_malloc_atomic(size);
+    }
+    return malloc(size);
+}
+
+static inline void *vm_realloc(void *ptr, size_t size) {
+    if (vm_mem_gc == VM_USE_LEAKS_BDWGC) {
+        return GC_realloc(ptr, size);
+    }
+    return realloc(ptr, size);
+}
+
+// none leaks on purpose, only tgc frees what it does not collect
+static inline void vm_free(void *ptr) {
+    if (vm_mem_gc == VM_USE_LEAKS_BDWGC) {
+        GC_free(ptr);
+    } else if (vm_mem_gc == VM_USE_LEAKS_TGC) {
+        free(ptr);
+    }
+}
 #endif
 
 #if defined(_WIN32)
@@ -3,6 +3,74 @@
 #include "./ir.h"
 #include "./std/libs/io.h"
 
+static struct {
+    vm_string_t **strs;
+    uint32_t used;
+    uint8_t alloc;
+} vm_string_table;
+
+static uint64_t vm_string_hash(const char *str, size_t len) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+static void vm_string_table_grow(void) {
+    vm_string_t **old_strs = vm_string_table.strs;
+    uint32_t old_size = old_strs == NULL ? 0 : UINT32_C(1) << vm_string_table.alloc;
+    vm_string_table.alloc = old_strs == NULL ? 8 : vm_string_table.alloc + 1;
+    uint32_t size = UINT32_C(1) << vm_string_table.alloc;
+    uint32_t mask = size - 1;
+    vm_string_table.strs = vm_malloc(sizeof(vm_string_t *) * size);
+    memset(vm_string_table.strs, 0, sizeof(vm_string_t *) * size);
+    for (uint32_t i = 0; i < old_size; i++) {
+        vm_string_t *str = old_strs[i];
+        if (str == NULL) {
+            continue;
+        }
+        uint32_t head = (uint32_t)str->hash & mask;
+        while (vm_string_table.strs[head] != NULL) {
+            head = (head + 1) & mask;
+        }
+        vm_string_table.strs[head] = str;
+    }
+    vm_free(old_strs);
+}
+
+const char *vm_string_intern(const char *str, size_t len) {
+    if (vm_string_table.strs == NULL || (vm_string_table.used + 1) * 4 > (UINT32_C(3) << vm_string_table.alloc)) {
+        vm_string_table_grow();
+    }
+    uint64_t hash = vm_string_hash(str, len);
+    uint32_t mask = (UINT32_C(1) << vm_string_table.alloc) - 1;
+    uint32_t head = (uint32_t)hash & mask;
+    while (true) {
+        vm_string_t *found = vm_string_table.strs[head];
+        if (found == NULL) {
+            break;
+        }
+        if (found->hash == hash && found->len == len && !memcmp(found->data, str, len)) {
+            return found->data;
+        }
+        head = (head + 1) & mask;
+    }
+    vm_string_t *ret = vm_malloc_atomic(sizeof(vm_string_t) + len + 1);
+    ret->hash = hash;
+    ret->len = (uint32_t)len;
+    memcpy(ret->data, str, len);
+    ret->data[len] = '\0';
+    vm_string_table.strs[head] = ret;
+    vm_string_table.used += 1;
+    return ret->data;
+}
+
+vm_string_t *vm_string_header(const char *str) {
+    return (vm_string_t *)(str - offsetof(vm_string_t, data));
+}
+
 bool vm_value_eq(vm_std_value_t lhs, vm_std_value_t rhs) {
     switch (lhs.tag) {
         case VM_TAG_NIL: {
@@ -162,7 +230,7 @@ bool vm_value_eq(vm_std_value_t lhs, vm_std_value_t rhs) {
             }
         }
         case VM_TAG_STR: {
-            return rhs.tag == VM_TAG_STR && !strcmp(lhs.value.str, rhs.value.str);
+            return rhs.tag == VM_TAG_STR && lhs.value.str == rhs.value.str;
         }
         default: {
             return lhs.tag == rhs.tag && lhs.value.all == rhs.value.all;
@@ -170,50 +238,296 @@ bool vm_value_eq(vm_std_value_t lhs, vm_std_value_t rhs) {
     }
 }
 
-vm_table_t *vm_table_new(void) {
-    vm_table_t *ret = vm_malloc(sizeof(vm_table_t));
-    *ret = (vm_table_t){0};
+static uint64_t vm_hash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+}
+
+// numbers that compare equal across tags are the same key, so integral
+// values of any numeric tag come out as the same int64_t here
+static bool vm_value_to_int(vm_std_value_t value, int64_t *out) {
+    switch (value.tag) {
+        case VM_TAG_I8: {
+            *out = value.value.i8;
+            return true;
+        }
+        case VM_TAG_I16: {
+            *out = value.value.i16;
+            return true;
+        }
+        case VM_TAG_I32: {
+            *out = value.value.i32;
+            return true;
+        }
+        case VM_TAG_I64: {
+            *out = value.value.i64;
+            return true;
+        }
+        case VM_TAG_F32:
+        case VM_TAG_F64: {
+            double f64 = value.tag == VM_TAG_F32 ? (double)value.value.f32 : value.value.f64;
+            if (f64 >= -9.2e18 && f64 <= 9.2e18 && f64 == (double)(int64_t)f64) {
+                *out = (int64_t)f64;
+                return true;
+            }
+            return false;
+        }
+        default: {
+            return false;
+        }
+    }
+}
+
+uint64_t vm_value_hash(vm_std_value_t value) {
+    int64_t i64;
+    if (vm_value_to_int(value, &i64)) {
+        return vm_hash_mix((uint64_t)i64);
+    }
+    switch (value.tag) {
+        case VM_TAG_BOOL: {
+            return vm_hash_mix(value.value.b);
+        }
+        case VM_TAG_F32: {
+            double f64 = value.value.f32;
+            uint64_t bits;
+            memcpy(&bits, &f64, sizeof(double));
+            return vm_hash_mix(bits);
+        }
+        case VM_TAG_F64: {
+            uint64_t bits;
+            memcpy(&bits, &value.value.f64, sizeof(double));
+            return vm_hash_mix(bits);
+        }
+        case VM_TAG_STR: {
+            return vm_string_header(value.value.str)->hash;
+        }
+        case VM_TAG_FUN: {
+            return vm_hash_mix((uint64_t)value.value.i32);
+        }
+        default: {
+            return vm_hash_mix((uint64_t)(size_t)value.value.all);
+        }
+    }
+}
+
+static _Thread_local vm_nursery_t vm_nursery;
+
+vm_table_t *vm_table_new_in(vm_nursery_t *nursery) {
+    vm_table_t *ret = vm_nursery_alloc(nursery, sizeof(vm_table_t), VM_GC_KIND_TABLE);
+    ret->shape = vm_shape_root();
     return ret;
 }
 
-static vm_pair_t *vm_table_lookup(vm_table_t *table, vm_value_t key_val, uint32_t key_tag) {
-    uint32_t head = 0;
-    vm_std_value_t lhs = (vm_std_value_t){
-        .tag = key_tag,
-        .value = key_val,
-    };
-    while (head * sizeof(vm_pair_t) < table->nbytes) {
+vm_table_t *vm_table_new(void) {
+    return vm_table_new_in(&vm_nursery);
+}
+
+vm_std_value_t *vm_closure_new(uint32_t nslots) {
+    return vm_nursery_alloc(&vm_nursery, (uint32_t)(sizeof(vm_std_value_t) * nslots), VM_GC_KIND_CLOSURE);
+}
+
+static vm_pair_t *vm_table_lookup(vm_table_t *table, vm_std_value_t key) {
+    if (table->pairs == NULL) {
+        return NULL;
+    }
+    uint32_t mask = (UINT32_C(1) << table->alloc) - 1;
+    uint32_t head = (uint32_t)vm_value_hash(key) & mask;
+    while (true) {
         vm_pair_t *pair = &table->pairs[head];
+        if (pair->key_tag == VM_TAG_UNK) {
+            return NULL;
+        }
         vm_std_value_t rhs = (vm_std_value_t){.tag = pair->key_tag, .value = pair->key_val};
-        if (vm_value_eq(lhs, rhs)) {
+        if (vm_value_eq(key, rhs)) {
             return pair;
         }
-        head += 1;
+        head = (head + 1) & mask;
     }
-    return NULL;
 }
 
-void vm_table_set(vm_table_t *table, vm_value_t key_val, vm_value_t val_val, uint32_t key_tag, uint32_t val_tag) {
-    vm_pair_t *pair = vm_table_lookup(table, key_val, key_tag);
+// finds the slot for a key that is known not to be in the table yet
+static vm_pair_t *vm_table_lookup_empty(vm_table_t *table, vm_std_value_t key) {
+    uint32_t mask = (UINT32_C(1) << table->alloc) - 1;
+    uint32_t head = (uint32_t)vm_value_hash(key) & mask;
+    while (table->pairs[head].key_tag != VM_TAG_UNK) {
+        head = (head + 1) & mask;
+    }
+    return &table->pairs[head];
+}
+
+static void vm_table_hash_grow(vm_table_t *table) {
+    vm_pair_t *old_pairs = table->pairs;
+    uint32_t old_size = old_pairs == NULL ? 0 : UINT32_C(1) << table->alloc;
+    if (old_pairs == NULL) {
+        table->alloc = 2;
+    } else {
+        table->alloc += 1;
+    }
+    uint32_t size = UINT32_C(1) << table->alloc;
+    table->pairs = vm_malloc(sizeof(vm_pair_t) * size);
+    memset(table->pairs, 0, sizeof(vm_pair_t) * size);
+    for (uint32_t i = 0; i < old_size; i++) {
+        vm_pair_t *pair = &old_pairs[i];
+        if (pair->key_tag == VM_TAG_UNK) {
+            continue;
+        }
+        vm_std_value_t key = (vm_std_value_t){.tag = pair->key_tag, .value = pair->key_val};
+        *vm_table_lookup_empty(table, key) = *pair;
+    }
+    vm_free(old_pairs);
+}
+
+// backward shift deletion, keeps every probe sequence unbroken without tombstones
+static void vm_table_hash_remove(vm_table_t *table, vm_pair_t *pair) {
+    uint32_t mask = (UINT32_C(1) << table->alloc) - 1;
+    uint32_t hole = (uint32_t)(pair - table->pairs);
+    uint32_t head = hole;
+    while (true) {
+        head = (head + 1) & mask;
+        vm_pair_t *next = &table->pairs[head];
+        if (next->key_tag == VM_TAG_UNK) {
+            break;
+        }
+        vm_std_value_t key = (vm_std_value_t){.tag = next->key_tag, .value = next->key_val};
+        uint32_t home = (uint32_t)vm_value_hash(key) & mask;
+        if (((head - home) & mask) >= ((head - hole) & mask)) {
+            table->pairs[hole] = *next;
+            hole = head;
+        }
+    }
+    table->pairs[hole] = (vm_pair_t){0};
+    table->used -= 1;
+}
+
+// moves the border forward over any values that are already set
+static void vm_table_border_advance(vm_table_t *table) {
+    while (table->len < table->arr_len && table->arr[table->len].tag != VM_TAG_NIL) {
+        table->len += 1;
+    }
+}
+
+static void vm_table_hash_set(vm_table_t *table, vm_std_value_t key, vm_std_value_t val) {
+    vm_pair_t *pair = vm_table_lookup(table, key);
+    // a nil value is never stored, so keys that are set and cleared do not pile up
+    if (val.tag == VM_TAG_NIL) {
+        if (pair != NULL) {
+            vm_table_hash_remove(table, pair);
+        }
+        return;
+    }
     if (pair != NULL) {
-        pair->val_val = val_val;
-        pair->val_tag = val_tag;
+        pair->val_val = val.value;
+        pair->val_tag = val.tag;
         return;
     }
-    size_t head = table->nbytes / sizeof(vm_pair_t);
-    table->nbytes += sizeof(vm_pair_t);
-    if (table->nbytes >= (UINT32_C(1) << table->alloc)) {
-        while (table->nbytes >= (UINT32_C(1) << table->alloc)) {
-            table->alloc += 1;
-        }
-        table->pairs = vm_realloc(table->pairs, UINT32_C(1) << table->alloc);
+    if (table->pairs == NULL || (table->used + 1) * 4 > (UINT32_C(3) << table->alloc)) {
+        vm_table_hash_grow(table);
     }
-    table->pairs[head] = (vm_pair_t){
-        .key_val = key_val,
-        .val_val = val_val,
-        .key_tag = key_tag,
-        .val_tag = val_tag,
+    *vm_table_lookup_empty(table, key) = (vm_pair_t){
+        .key_val = key.value,
+        .val_val = val.value,
+        .key_tag = key.tag,
+        .val_tag = val.tag,
     };
+    table->used += 1;
+}
+
+// moves the string keys out of the slots, the table stays shapeless from then on
+static void vm_table_to_dict(vm_table_t *table) {
+    vm_shape_t *shape = table->shape;
+    table->shape = NULL;
+    for (uint32_t i = 0; i < shape->nslots; i++) {
+        vm_std_value_t key = (vm_std_value_t){
+            .tag = VM_TAG_STR,
+            .value.str = vm_shape_key(shape, i),
+        };
+        vm_table_hash_set(table, key, table->slots[i]);
+    }
+    vm_free(table->slots);
+    table->slots = NULL;
+    table->slots_alloc = 0;
+}
+
+// returns false when the table had to leave shape mode instead
+static bool vm_table_slots_set(vm_table_t *table, const char *key, vm_std_value_t val) {
+    int32_t slot = vm_shape_find(table->shape, key);
+    if (slot >= 0) {
+        table->slots[slot] = val;
+        return true;
+    }
+    uint32_t nslots = table->shape->nslots;
+    if (nslots >= VM_SHAPE_MAX_SLOTS) {
+        vm_table_to_dict(table);
+        return false;
+    }
+    if (nslots >= table->slots_alloc) {
+        table->slots_alloc = table->slots_alloc == 0 ? 4 : table->slots_alloc * 2;
+        table->slots = vm_realloc(table->slots, sizeof(vm_std_value_t) * table->slots_alloc);
+    }
+    table->slots[nslots] = val;
+    table->shape = vm_shape_add(table->shape, key);
+    return true;
+}
+
+static void vm_table_arr_push(vm_table_t *table, vm_std_value_t value) {
+    if (table->arr_len >= table->arr_alloc) {
+        table->arr_alloc = table->arr_alloc == 0 ? 4 : table->arr_alloc * 2;
+        table->arr = vm_realloc(table->arr, sizeof(vm_std_value_t) * table->arr_alloc);
+    }
+    table->arr[table->arr_len++] = value;
+}
+
+void vm_table_set(vm_table_t *table, vm_value_t key_val, vm_value_t val_val, uint32_t key_tag, uint32_t val_tag) {
+    vm_gc_barrier(table, key_tag);
+    vm_gc_barrier(table, val_tag);
+    vm_std_value_t key = (vm_std_value_t){
+        .tag = key_tag,
+        .value = key_val,
+    };
+    vm_std_value_t val = (vm_std_value_t){
+        .tag = val_tag,
+        .value = val_val,
+    };
+    int64_t index;
+    if (vm_value_to_int(key, &index) && index >= 1 && index <= (int64_t)table->arr_len + 1 && index < UINT32_MAX) {
+        if (index <= table->arr_len) {
+            table->arr[index - 1] = val;
+            if (val_tag == VM_TAG_NIL) {
+                if (index <= table->len) {
+                    table->len = (uint32_t)index - 1;
+                }
+            } else if (index == table->len + 1) {
+                vm_table_border_advance(table);
+            }
+            return;
+        }
+        vm_table_arr_push(table, val);
+        // the array part just grew, so pull the keys that continue it out of the hash part
+        while (table->used != 0) {
+            vm_std_value_t next_key = (vm_std_value_t){
+                .tag = VM_TAG_I64,
+                .value.i64 = (int64_t)table->arr_len + 1,
+            };
+            vm_pair_t *next = vm_table_lookup(table, next_key);
+            if (next == NULL) {
+                break;
+            }
+            vm_table_arr_push(table, (vm_std_value_t){.tag = next->val_tag, .value = next->val_val});
+            vm_table_hash_remove(table, next);
+        }
+        vm_table_border_advance(table);
+        return;
+    }
+    if (key_tag == VM_TAG_STR && table->shape != NULL) {
+        if (vm_table_slots_set(table, key_val.str, val)) {
+            return;
+        }
+    }
+    vm_table_hash_set(table, key, val);
 }
 
 void vm_table_set_pair(vm_table_t *table, vm_pair_t *pair) {
@@ -221,9 +535,28 @@ void vm_table_set_pair(vm_table_t *table, vm_pair_t *pair) {
 }
 
 void vm_table_get_pair(vm_table_t *table, vm_pair_t *out) {
-    vm_value_t key_val = out->key_val;
-    vm_tag_t key_tag = (vm_tag_t)out->key_tag;
-    vm_pair_t *pair = vm_table_lookup(table, key_val, key_tag);
+    vm_std_value_t key = (vm_std_value_t){
+        .tag = out->key_tag,
+        .value = out->key_val,
+    };
+    int64_t index;
+    if (table->arr_len != 0 && vm_value_to_int(key, &index) && index >= 1 && index <= table->arr_len) {
+        vm_std_value_t value = table->arr[index - 1];
+        out->val_val = value.value;
+        out->val_tag = value.tag;
+        return;
+    }
+    if (key.tag == VM_TAG_STR && table->shape != NULL) {
+        int32_t slot = vm_shape_find(table->shape, key.value.str);
+        if (slot >= 0) {
+            out->val_val = table->slots[slot].value;
+            out->val_tag = table->slots[slot].tag;
+        } else {
+            out->val_tag = VM_TAG_NIL;
+        }
+        return;
+    }
+    vm_pair_t *pair = vm_table_lookup(table, key);
     if (pair != NULL) {
         out->val_val = pair->val_val;
         out->val_tag = pair->val_tag;
@@ -233,34 +566,43 @@ void vm_table_get_pair(vm_table_t *table, vm_pair_t *out) {
     return;
 }
 
-double vm_table_len(vm_table_t *table) {
-    int64_t check = 1;
-    uint32_t head = 0;
-    while (head * sizeof(vm_pair_t) < table->nbytes) {
-        vm_pair_t *pair = &table->pairs[head];
-        switch (pair->key_tag) {
-            // case VM_TAG_I64: {
-            //     if (pair->key_val.i64 == check) {
-            //         check += 1;
-            //         head = 0;
-            //         goto next;
-            //     }
-            //     break;
-            // }
-            case VM_TAG_F64: {
-                if (pair->key_val.f64 == (double)check) {
-                    check += 1;
-                    head = 0;
-                    goto next;
-                }
-                break;
-            }
-            default: {
-                break;
-            }
-        }
-        head += 1;
-    next:;
+// no table ever has this shape, so a fresh cache always misses once
+static vm_shape_t vm_table_cache_none;
+
+vm_table_cache_t *vm_table_cache_new(void) {
+    vm_table_cache_t *ret = vm_malloc(sizeof(vm_table_cache_t));
+    *ret = (vm_table_cache_t){
+        .shape = &vm_table_cache_none,
+        .slot = 0,
+    };
+    return ret;
+}
+
+void vm_table_cache_fill(vm_table_t *table, const char *key, vm_table_cache_t *cache) {
+    if (table->shape == NULL) {
+        return;
+    }
+    int32_t slot = vm_shape_find(table->shape, key);
+    if (slot >= 0) {
+        cache->shape = table->shape;
+        cache->slot = (uint32_t)slot;
     }
-    return (double)(check - 1);
+}
+
+void vm_table_get_cached(vm_table_t *table, vm_pair_t *out, vm_table_cache_t *cache) {
+    vm_table_get_pair(table, out);
+    if (out->key_tag == VM_TAG_STR) {
+        vm_table_cache_fill(table, out->key_val.str, cache);
+    }
+}
+
+void vm_table_set_cached(vm_table_t *table, vm_value_t key_val, vm_value_t val_val, uint32_t key_tag, uint32_t val_tag, vm_table_cache_t *cache) {
+    vm_table_set(table, key_val, val_val, key_tag, val_tag);
+    if (key_tag == VM_TAG_STR) {
+        vm_table_cache_fill(table, key_val.str, cache);
+    }
+}
+
+uint32_t vm_table_len(vm_table_t *table) {
+    return table->len;
 }
@@ -1,7 +1,9 @@
 #if !defined(VM_HEADER_TABLE)
 #define VM_HEADER_TABLE
 
+#include "gc.h"
 #include "lib.h"
+#include "shape.h"
 #include "tag.h"
 
 union vm_value_t;
@@ -16,6 +18,12 @@ typedef struct vm_table_t vm_table_t;
 struct vm_std_value_t;
 typedef struct vm_std_value_t vm_std_value_t;
 
+struct vm_string_t;
+typedef struct vm_string_t vm_string_t;
+
+struct vm_table_cache_t;
+typedef struct vm_table_cache_t vm_table_cache_t;
+
 union vm_value_t {
     bool b;
     int8_t i8;
@@ -43,18 +51,57 @@ struct vm_pair_t {
     uint32_t val_tag;
 };
 
+// every VM_TAG_STR value points at the data of an interned vm_string_t,
+// so two strings are equal exactly when their pointers are
+struct vm_string_t {
+    uint64_t hash;
+    uint32_t len;
+    char data[];
+};
+
 struct vm_table_t {
+    // string keys live in slots laid out by the shape, NULL shape means
+    // the table has too many of them and they are in the hash part
+    vm_shape_t *shape;
+    vm_std_value_t *slots;
+    // hash part: open addressed, (1 << alloc) slots, empty slots have key_tag == VM_TAG_UNK
     vm_pair_t *pairs;
-    uint32_t nbytes;
+    // array part: holds the values for keys 1 .. arr_len
+    vm_std_value_t *arr;
+    // border: arr[0 .. len-1] are non-nil and arr[len] is nil or past arr_len
+    uint32_t len;
+    uint32_t used;
+    uint32_t arr_len;
+    uint32_t arr_alloc;
+    uint32_t slots_alloc;
     uint8_t alloc;
 };
 
+const char *vm_string_intern(const char *str, size_t len);
+vm_string_t *vm_string_header(const char *str);
+
+// inline cache for one constant string key GET or SET site in jitted code:
+// any table with the cached shape holds that key in the cached slot
+struct vm_table_cache_t {
+    vm_shape_t *shape;
+    uint32_t slot;
+};
+
 bool vm_value_eq(vm_std_value_t lhs, vm_std_value_t rhs);
+uint64_t vm_value_hash(vm_std_value_t value);
 
 vm_table_t *vm_table_new(void);
+vm_table_t *vm_table_new_in(vm_nursery_t *nursery);
+// slot 0 is the function, the captures follow it
+vm_std_value_t *vm_closure_new(uint32_t nslots);
 void vm_table_set(vm_table_t *table, vm_value_t key_val, vm_value_t val_val, uint32_t key_tag, uint32_t val_tag);
 void vm_table_set_pair(vm_table_t *table, vm_pair_t *pair);
 void vm_table_get_pair(vm_table_t *table, vm_pair_t *pair);
-double vm_table_len(vm_table_t *table);
+vm_table_cache_t *vm_table_cache_new(void);
+// points cache at the slot of key in the shape of table, if it has one
+void vm_table_cache_fill(vm_table_t *table, const char *key, vm_table_cache_t *cache);
+void vm_table_get_cached(vm_table_t *table, vm_pair_t *pair, vm_table_cache_t *cache);
+void vm_table_set_cached(vm_table_t *table, vm_value_t key_val, vm_value_t val_val, uint32_t key_tag, uint32_t val_tag, vm_table_cache_t *cache);
+uint32_t vm_table_len(vm_table_t *table);
 
 #endif
@@ -5,6 +5,52 @@
 #include "ir.h"
 #include "type.h"
 
+vm_rblock_t *vm_rblock_next(vm_branch_t *branch, vm_tag_t tag) {
+    if (branch->rtargets[tag] == NULL) {
+        vm_block_t *from = branch->targets[0];
+        vm_tags_t *regs = vm_rblock_regs_dup(branch->tags, from->nregs);
+        regs->tags[branch->out.reg] = tag;
+        branch->rtargets[tag] = vm_rblock_new(from, regs);
+    }
+    return branch->rtargets[tag];
+}
+
+vm_rblock_t *vm_rblock_call_target(vm_block_t **blocks, vm_branch_t *branch, size_t block_num) {
+    if (branch->call_table[block_num] != NULL) {
+        return branch->call_table[block_num];
+    }
+    vm_block_t *block = blocks[block_num];
+    if (!block->isfunc) {
+        return NULL;
+    }
+    size_t nargs = 0;
+    for (size_t i = 1; branch->args[i].type != VM_ARG_NONE; i++) {
+        nargs += 1;
+    }
+    vm_tags_t *regs = vm_rblock_regs_empty(block->nregs);
+    if (branch->args[0].reg_tag == VM_TAG_CLOSURE) {
+        if (block->nargs != 0) {
+            regs->tags[block->args[0].reg] = VM_TAG_CLOSURE;
+            for (size_t i = 1; i < block->nargs; i++) {
+                if (i <= nargs) {
+                    regs->tags[block->args[i].reg] = vm_arg_to_tag(branch->args[i]);
+                } else {
+                    regs->tags[block->args[i].reg] = VM_TAG_NIL;
+                }
+            }
+        }
+    } else {
+        if (block->nargs != nargs) {
+            return NULL;
+        }
+        for (size_t i = 1; i <= block->nargs; i++) {
+            regs->tags[block->args[i - 1].reg] = vm_arg_to_tag(branch->args[i]);
+        }
+    }
+    branch->call_table[block_num] = vm_rblock_new(block, regs);
+    return branch->call_table[block_num];
+}
+
 vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *rblock) {
     void *cache = vm_cache_get(rblock->block->cache, rblock);
     if (cache != NULL) {
@@ -15,6 +61,11 @@ vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *
     vm_tags_t *regs = vm_rblock_regs_dup(rblock->regs, rblock->block->nregs);
     *ret = *rblock->block;
     ret->label = -1;
+    ret->base = rblock->block;
+    ret->tags = rblock->regs;
+    ret->tails = NULL;
+    ret->loop = NULL;
+    ret->loop_walk = 0;
     ret->instrs = vm_malloc(sizeof(vm_instr_t) * rblock->block->len);
     ret->args = vm_malloc(sizeof(vm_arg_t) * ret->nargs);
     ret->mark = false;
@@ -37,6 +88,7 @@ vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *
         }
     }
     vm_branch_t branch = vm_rblock_type_specialize_branch(regs, rblock->block->branch);
+    vm_branch_copy_profile(&branch, &rblock->block->branch);
     for (size_t i = 0; branch.args[i].type != VM_ARG_NONE; i++) {
         if (branch.args[i].type == VM_ARG_REG) {
             branch.args[i].reg_tag = regs->tags[branch.args[i].reg];
@@ -58,9 +110,9 @@ vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *
                     }
                 }
             }
+            branch.tags = vm_rblock_regs_dup(regs, from->nregs);
             for (size_t i = 1; i < VM_TAG_MAX; i++) {
-                regs->tags[branch.out.reg] = i;
-                branch.rtargets[i] = vm_rblock_new(from, vm_rblock_regs_dup(regs, from->nregs));
+                branch.rtargets[i] = NULL;
             }
             break;
         }
@@ -80,52 +132,9 @@ vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *
                 };
             }
             if (branch.args[0].type == VM_ARG_REG) {
-                if (branch.args[0].reg_tag == VM_TAG_FUN) {
-                    size_t nargs = 0;
-                    for (size_t i = 1; branch.args[i].type != VM_ARG_NONE; i++) {
-                        nargs += 1;
-                    }
-                    branch.call_table = vm_malloc(sizeof(vm_rblock_t *) * nblocks);
-                    for (size_t j = 0; j < nblocks; j++) {
-                        if (!blocks[j]->isfunc || blocks[j]->nargs != nargs) {
-                            branch.call_table[j] = NULL;
-                            continue;
-                        }
-                        vm_tags_t *regs2 = vm_rblock_regs_empty(blocks[j]->nregs);
-                        for (size_t i = 1; i <= blocks[j]->nargs; i++) {
-                            if (i <= nargs) {
-                                regs2->tags[blocks[j]->args[i - 1].reg] = vm_arg_to_tag(branch.args[i]);
-                            } else {
-                                regs2->tags[blocks[j]->args[i - 1].reg] = VM_TAG_NIL;
-                            }
-                        }
-                        branch.call_table[j] = vm_rblock_new(blocks[j], regs2);
-                    }
-                }
-                if (branch.args[0].reg_tag == VM_TAG_CLOSURE) {
-                    size_t nargs = 0;
-                    for (size_t i = 1; branch.args[i].type != VM_ARG_NONE; i++) {
-                        nargs += 1;
-                    }
+                if (branch.args[0].reg_tag == VM_TAG_FUN || branch.args[0].reg_tag == VM_TAG_CLOSURE) {
                     branch.call_table = vm_malloc(sizeof(vm_rblock_t *) * nblocks);
-                    for (size_t j = 0; j < nblocks; j++) {
-                        if (!blocks[j]->isfunc) {
-                            branch.call_table[j] = NULL;
-                            continue;
-                        }
-                        vm_tags_t *regs2 = vm_rblock_regs_empty(blocks[j]->nregs);
-                        if (blocks[j]->nargs != 0) {
-                            regs2->tags[blocks[j]->args[0].reg] = VM_TAG_CLOSURE;
-                            for (size_t i = 1; i < blocks[j]->nargs; i++) {
-                                if (i <= nargs) {
-                                    regs2->tags[blocks[j]->args[i].reg] = vm_arg_to_tag(branch.args[i]);
-                                } else {
-                                    regs2->tags[blocks[j]->args[i].reg] = VM_TAG_NIL;
-                                }
-                            }
-                        }
-                        branch.call_table[j] = vm_rblock_new(blocks[j], regs2);
-                    }
+                    memset(branch.call_table, 0, sizeof(vm_rblock_t *) * nblocks);
                 }
             }
             for (size_t i = 0; i < from->nargs; i++) {
@@ -136,9 +145,9 @@ vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *
                     }
                 }
             }
+            branch.tags = vm_rblock_regs_dup(regs, from->nregs);
             for (size_t i = 1; i < VM_TAG_MAX; i++) {
-                regs->tags[branch.out.reg] = i;
-                branch.rtargets[i] = vm_rblock_new(from, vm_rblock_regs_dup(regs, from->nregs));
+                branch.rtargets[i] = NULL;
             }
             break;
         }
@@ -170,13 +179,115 @@ vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *
         }
     }
     ret->branch = branch;
+    // args are typed as they come in, continuations store them that way
     for (size_t i = 0; i < ret->nargs; i++) {
         if (ret->args[i].type == VM_ARG_REG) {
-            ret->args[i].reg_tag = regs->tags[ret->args[i].reg];
+            ret->args[i].reg_tag = rblock->regs->tags[ret->args[i].reg];
         }
     }
     // if (!vm_check_block(ret)) {
     //     return NULL;
     // }
     return ret;
-}
\ No newline at end of file
+}
+
+// adds arg to the args of block if it is a register not set before it
+static void vm_rblock_tail_arg(vm_block_t *block, bool *defined, vm_arg_t arg) {
+    if (arg.type != VM_ARG_REG || defined[arg.reg]) {
+        return;
+    }
+    for (size_t i = 0; i < block->nargs; i++) {
+        if (block->args[i].reg == arg.reg) {
+            return;
+        }
+    }
+    block->args[block->nargs++] = (vm_arg_t){
+        .type = VM_ARG_REG,
+        .reg = arg.reg,
+    };
+}
+
+// the block of what follows instrs[n] of base, its args are the registers
+// live into it, it shares the cache of base
+static vm_block_t *vm_rblock_rest(vm_block_t *base, size_t n) {
+    if (base->rests == NULL) {
+        base->rests = vm_malloc(sizeof(vm_block_t *) * base->len);
+        memset(base->rests, 0, sizeof(vm_block_t *) * base->len);
+    }
+    if (base->rests[n] != NULL) {
+        return base->rests[n];
+    }
+    vm_block_t *rest = vm_malloc(sizeof(vm_block_t));
+    *rest = *base;
+    rest->alloc = 0;
+    rest->instrs = &base->instrs[n + 1];
+    rest->len = base->len - n - 1;
+    rest->nargs = 0;
+    rest->args = vm_malloc(sizeof(vm_arg_t) * (base->nregs + 1));
+    rest->pass = NULL;
+    rest->tails = NULL;
+    rest->rests = NULL;
+    rest->isfunc = false;
+    bool *defined = vm_malloc(sizeof(bool) * (base->nregs + 1));
+    memset(defined, 0, sizeof(bool) * (base->nregs + 1));
+    for (size_t i = 0; i < rest->len; i++) {
+        vm_instr_t instr = rest->instrs[i];
+        for (size_t j = 0; instr.args[j].type != VM_ARG_NONE; j++) {
+            vm_rblock_tail_arg(rest, defined, instr.args[j]);
+        }
+        if (instr.out.type == VM_ARG_REG) {
+            defined[instr.out.reg] = true;
+        }
+    }
+    vm_branch_t branch = rest->branch;
+    for (size_t j = 0; branch.args[j].type != VM_ARG_NONE; j++) {
+        vm_rblock_tail_arg(rest, defined, branch.args[j]);
+    }
+    if (branch.out.type == VM_ARG_REG) {
+        defined[branch.out.reg] = true;
+    }
+    size_t ntargets = 0;
+    switch (branch.op) {
+        case VM_BOP_JUMP:
+        case VM_BOP_GET:
+        case VM_BOP_CALL: {
+            ntargets = 1;
+            break;
+        }
+        case VM_BOP_BB:
+        case VM_BOP_BEQ:
+        case VM_BOP_BLT: {
+            ntargets = 2;
+            break;
+        }
+    }
+    for (size_t i = 0; i < ntargets; i++) {
+        vm_block_t *target = branch.targets[i];
+        for (size_t j = 0; j < target->nargs; j++) {
+            vm_rblock_tail_arg(rest, defined, target->args[j]);
+        }
+    }
+    vm_free(defined);
+    base->rests[n] = rest;
+    return rest;
+}
+
+vm_rblock_t *vm_rblock_tail(vm_block_t *block, size_t n, vm_tag_t tag) {
+    if (block->tails == NULL) {
+        block->tails = vm_malloc(sizeof(vm_rblock_t *) * block->len);
+        memset(block->tails, 0, sizeof(vm_rblock_t *) * block->len);
+    }
+    if (block->tails[n] != NULL) {
+        return block->tails[n];
+    }
+    vm_block_t *rest = vm_rblock_rest(block->base, n);
+    vm_tags_t *regs = vm_rblock_regs_dup(block->tags, block->nregs);
+    for (size_t i = 0; i < n; i++) {
+        if (block->instrs[i].out.type == VM_ARG_REG) {
+            regs->tags[block->instrs[i].out.reg] = block->instrs[i].tag;
+        }
+    }
+    regs->tags[block->instrs[n].out.reg] = tag;
+    block->tails[n] = vm_rblock_new(rest, regs);
+    return block->tails[n];
+}
@@ -5,5 +5,10 @@
 #include "ir.h"
 
 vm_block_t *vm_rblock_version(size_t nblocks, vm_block_t **blocks, vm_rblock_t *rblock);
+vm_rblock_t *vm_rblock_next(vm_branch_t *branch, vm_tag_t tag);
+vm_rblock_t *vm_rblock_call_target(vm_block_t **blocks, vm_branch_t *branch, size_t block_num);
+// the rest of a version after instrs[n], with the output of instrs[n] retyped
+// to tag, not versioned yet, its versions count against the base block's
+vm_rblock_t *vm_rblock_tail(vm_block_t *block, size_t n, vm_tag_t tag);
 
 #endif
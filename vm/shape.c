@@ -0,0 +1,94 @@
+#include "./shape.h"
+
+#include "./obj.h"
+
+static vm_shape_t vm_shape_empty;
+
+vm_shape_t *vm_shape_root(void) {
+    return &vm_shape_empty;
+}
+
+vm_shape_t *vm_shape_add(vm_shape_t *shape, const char *key) {
+    for (size_t i = 0; i < shape->next.len; i++) {
+        vm_shape_t *next = shape->next.ptr[i];
+        if (next->key == key) {
+            return next;
+        }
+    }
+    vm_shape_t *ret = vm_malloc(sizeof(vm_shape_t));
+    *ret = (vm_shape_t){
+        .parent = shape,
+        .key = key,
+        .nslots = shape->nslots + 1,
+    };
+    if (shape->next.len + 1 >= shape->next.alloc) {
+        shape->next.alloc = (shape->next.len + 1) * 2;
+        shape->next.ptr = vm_realloc(shape->next.ptr, sizeof(vm_shape_t *) * shape->next.alloc);
+    }
+    shape->next.ptr[shape->next.len++] = ret;
+    return ret;
+}
+
+static uint32_t vm_shape_index_size(vm_shape_t *shape) {
+    uint32_t size = 1;
+    while (size < shape->nslots * 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+static void vm_shape_build(vm_shape_t *shape) {
+    const char **keys = vm_malloc(sizeof(const char *) * shape->nslots);
+    uint32_t slot = shape->nslots;
+    for (vm_shape_t *cur = shape; cur->parent != NULL; cur = cur->parent) {
+        keys[--slot] = cur->key;
+    }
+    if (shape->nslots > VM_SHAPE_SCAN_SLOTS) {
+        uint32_t size = vm_shape_index_size(shape);
+        uint32_t *index = vm_malloc(sizeof(uint32_t) * size);
+        memset(index, 0, sizeof(uint32_t) * size);
+        for (uint32_t i = 0; i < shape->nslots; i++) {
+            uint32_t head = (uint32_t)vm_string_header(keys[i])->hash & (size - 1);
+            while (index[head] != 0) {
+                head = (head + 1) & (size - 1);
+            }
+            index[head] = i + 1;
+        }
+        shape->index = index;
+    }
+    shape->keys = keys;
+}
+
+int32_t vm_shape_find(vm_shape_t *shape, const char *key) {
+    if (shape->nslots == 0) {
+        return -1;
+    }
+    if (shape->keys == NULL) {
+        vm_shape_build(shape);
+    }
+    if (shape->index == NULL) {
+        for (uint32_t i = 0; i < shape->nslots; i++) {
+            if (shape->keys[i] == key) {
+                return (int32_t)i;
+            }
+        }
+        return -1;
+    }
+    uint32_t size = vm_shape_index_size(shape);
+    uint32_t head = (uint32_t)vm_string_header(key)->hash & (size - 1);
+    while (shape->index[head] != 0) {
+        uint32_t slot = shape->index[head] - 1;
+        if (shape->keys[slot] == key) {
+            return (int32_t)slot;
+        }
+        head = (head + 1) & (size - 1);
+    }
+    return -1;
+}
+
+const char *vm_shape_key(vm_shape_t *shape, uint32_t slot) {
+    if (shape->keys == NULL) {
+        vm_shape_build(shape);
+    }
+    return shape->keys[slot];
+}
@@ -0,0 +1,36 @@
+#if !defined(VM_HEADER_SHAPE)
+#define VM_HEADER_SHAPE
+
+#include "lib.h"
+
+// tables with more string keys than this keep them in the hash part instead
+#define VM_SHAPE_MAX_SLOTS 64
+// shapes with more slots than this get a hashed index instead of a linear scan
+#define VM_SHAPE_SCAN_SLOTS 8
+
+struct vm_shape_t;
+typedef struct vm_shape_t vm_shape_t;
+
+// shapes form a transition tree rooted at the empty shape, each edge adds
+// one interned string key, and the key added by the nth edge lives in slot n
+struct vm_shape_t {
+    vm_shape_t *parent;
+    const char *key;
+    uint32_t nslots;
+    struct {
+        size_t len;
+        vm_shape_t **ptr;
+        size_t alloc;
+    } next;
+    // built on first lookup: keys[n] is the key in slot n
+    const char **keys;
+    // built on first lookup past VM_SHAPE_SCAN_SLOTS: slot + 1 by key hash, 0 is empty
+    uint32_t *index;
+};
+
+vm_shape_t *vm_shape_root(void);
+vm_shape_t *vm_shape_add(vm_shape_t *shape, const char *key);
+int32_t vm_shape_find(vm_shape_t *shape, const char *key);
+const char *vm_shape_key(vm_shape_t *shape, uint32_t slot);
+
+#endif
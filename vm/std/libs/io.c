@@ -9,7 +9,7 @@ char *vm_io_read(const char *filename) {
         return NULL;
     }
     size_t nalloc = 512;
-    char *ops = vm_malloc(sizeof(char) * nalloc);
+    char *ops = vm_malloc_atomic(sizeof(char) * nalloc);
     size_t nops = 0;
     size_t size;
     for (;;) {
@@ -154,9 +154,25 @@ void vm_io_debug(FILE *out, size_t indent, const char *prefix, vm_std_value_t va
                 break;
             }
             fprintf(out, "table(%p) {\n", tab);
-            for (size_t i = 0; i * sizeof(vm_pair_t) < tab->nbytes; i++) {
+            for (size_t i = 0; i < tab->arr_len; i++) {
+                char buf[64];
+                snprintf(buf, 63, "%zu = ", i + 1);
+                vm_io_debug(out, indent + 1, buf, tab->arr[i], &next);
+            }
+            if (tab->shape != NULL) {
+                for (uint32_t i = 0; i < tab->shape->nslots; i++) {
+                    char buf[64];
+                    snprintf(buf, 63, "%s = ", vm_shape_key(tab->shape, i));
+                    vm_io_debug(out, indent + 1, buf, tab->slots[i], &next);
+                }
+            }
+            size_t nslots = tab->pairs == NULL ? 0 : (size_t)1 << tab->alloc;
+            for (size_t i = 0; i < nslots; i++) {
                 vm_pair_t p = tab->pairs[i];
                 switch (p.key_tag) {
+                    case VM_TAG_UNK: {
+                        break;
+                    }
                     case VM_TAG_NIL: {
                         vm_std_value_t val = (vm_std_value_t){
                             .tag = p.val_tag,
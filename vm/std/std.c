@@ -49,7 +49,7 @@ void vm_std_vm_closure(vm_std_value_t *args) {
         };
         return;
     }
-    vm_std_value_t *vals = vm_malloc(sizeof(vm_std_value_t) * nargs);
+    vm_std_value_t *vals = vm_closure_new((uint32_t)nargs);
     for (size_t i = 0; args[i].tag != 0; i++) {
         vals[i] = args[i];
     }
@@ -133,6 +133,8 @@ void vm_std_print(vm_std_value_t *args) {
 
 vm_table_t *vm_std_new(void) {
     vm_table_t *std = vm_table_new();
+    // jit code has the address of this baked in
+    vm_gc_add_root(std);
 
     {
         vm_table_t *io = vm_table_new();
@@ -3,19 +3,19 @@
 
 #include "./std.h"
 
-#define VM_STD_SET_TAB(table, key, value) vm_table_set( \
-    (table),                                            \
-    (vm_value_t){.str = (key)},                         \
-    (vm_value_t){.all = (void *)(value)},               \
-    VM_TAG_STR,                                         \
-    VM_TAG_TAB                                          \
+#define VM_STD_SET_TAB(table, key, value) vm_table_set(        \
+    (table),                                                   \
+    (vm_value_t){.str = vm_string_intern((key), strlen(key))}, \
+    (vm_value_t){.all = (void *)(value)},                      \
+    VM_TAG_STR,                                                \
+    VM_TAG_TAB                                                 \
 )
-#define VM_STD_SET_FFI(table, key, value) vm_table_set( \
-    (table),                                            \
-    (vm_value_t){.str = (key)},                         \
-    (vm_value_t){.all = (void *)(value)},               \
-    VM_TAG_STR,                                         \
-    VM_TAG_FFI                                          \
+#define VM_STD_SET_FFI(table, key, value) vm_table_set(        \
+    (table),                                                   \
+    (vm_value_t){.str = vm_string_intern((key), strlen(key))}, \
+    (vm_value_t){.all = (void *)(value)},                      \
+    VM_TAG_STR,                                                \
+    VM_TAG_FFI                                                 \
 )
 
 static inline bool vm_std_parse_args(vm_std_value_t *args, const char *fmt, ...) {
@@ -12,6 +12,10 @@ vm_rblock_t *vm_rblock_new(vm_block_t *block, vm_tags_t *regs) {
     rblock->least_faults = SIZE_MAX;
     rblock->base_redo = 256;
     rblock->redo = 0;
+    rblock->uses.len = 0;
+    rblock->uses.ptr = NULL;
+    rblock->uses.alloc = 0;
+    rblock->sym = NULL;
     return rblock;
 }
 
@@ -19,55 +23,100 @@ void vm_cache_new(vm_cache_t *out) {
     *out = (vm_cache_t){0};
 }
 
+#define VM_CACHE_SIG_TAGS 16
+
+static uint64_t vm_cache_sig(vm_rblock_t *rblock, size_t start) {
+    uint64_t sig = 0;
+    for (size_t i = start; i < rblock->block->nargs && i < start + VM_CACHE_SIG_TAGS; i++) {
+        vm_tag_t tag = rblock->regs->tags[rblock->block->args[i].reg];
+        sig |= (uint64_t)tag << (4 * (i - start));
+    }
+    return sig;
+}
+
+static uint64_t vm_cache_hash(vm_rblock_t *rblock) {
+    uint64_t hash = (uint64_t)(size_t)rblock->block;
+    for (size_t i = 0; i == 0 || i < rblock->block->nargs; i += VM_CACHE_SIG_TAGS) {
+        hash ^= vm_cache_sig(rblock, i);
+        hash *= UINT64_C(0xff51afd7ed558ccd);
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static bool vm_cache_match(vm_cache_t *cache, size_t entry, vm_rblock_t *rblock, uint64_t hash) {
+    vm_rblock_t *found = cache->keys[entry];
+    if (cache->hashes[entry] != hash || found->block != rblock->block || cache->sigs[entry] != vm_cache_sig(rblock, 0)) {
+        return false;
+    }
+    for (size_t j = VM_CACHE_SIG_TAGS; j < rblock->block->nargs; j++) {
+        vm_arg_t arg = rblock->block->args[j];
+        if (rblock->regs->tags[arg.reg] != found->regs->tags[arg.reg]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void vm_cache_index_insert(vm_cache_t *cache, size_t entry) {
+    uint32_t mask = cache->index_alloc - 1;
+    uint32_t head = (uint32_t)cache->hashes[entry] & mask;
+    while (cache->index[head] != 0) {
+        head = (head + 1) & mask;
+    }
+    cache->index[head] = (uint32_t)entry + 1;
+}
+
 void *vm_cache_get(vm_cache_t *cache, vm_rblock_t *rblock) {
-    for (ptrdiff_t i = (ptrdiff_t)cache->len - 1; i >= 0; i--) {
-        vm_rblock_t *found = cache->keys[i];
-        if (rblock->block->isfunc == found->block->isfunc &&
-            rblock->block == found->block) {
-            for (size_t j = 0; j < rblock->block->nargs; j++) {
-                vm_arg_t arg = rblock->block->args[j];
-                if (rblock->regs->tags[arg.reg] != found->regs->tags[arg.reg]) {
-                    goto next;
-                }
-            }
-            return cache->values[i];
+    if (cache->len == 0) {
+        return NULL;
+    }
+    uint64_t hash = vm_cache_hash(rblock);
+    uint32_t mask = cache->index_alloc - 1;
+    uint32_t head = (uint32_t)hash & mask;
+    while (cache->index[head] != 0) {
+        size_t entry = cache->index[head] - 1;
+        if (vm_cache_match(cache, entry, rblock, hash)) {
+            return cache->values[entry];
         }
-    next:;
+        head = (head + 1) & mask;
     }
     return NULL;
 }
 
 void vm_cache_set(vm_cache_t *cache, vm_rblock_t *rblock, void *value) {
-    // for (ptrdiff_t i = (ptrdiff_t) cache->len - 1; i >= 0; i--) {
-    //     vm_rblock_t *found = cache->keys[i];
-    //     if (rblock->block->isfunc == found->block->isfunc &&
-    //         rblock->block == found->block) {
-    //         for (size_t j = 0; j < rblock->block->nargs; j++) {
-    //             vm_arg_t arg = rblock->block->args[j];
-    //             if (rblock->regs->tags[arg.reg] != found->regs->tags[arg.reg]) {
-    //                 goto next;
-    //             }
-    //         }
-    //         __builtin_trap();
-    //         // cache->values[i] = value;
-    //         // return;
-    //     }
-    // next:;
-    // }
     if (cache->len + 1 >= cache->alloc) {
         cache->alloc = (cache->len + 1) * 2;
         cache->keys = vm_realloc(cache->keys, sizeof(vm_rblock_t *) * cache->alloc);
         cache->values = vm_realloc(cache->values, sizeof(void *) * cache->alloc);
+        cache->sigs = vm_realloc(cache->sigs, sizeof(uint64_t) * cache->alloc);
+        cache->hashes = vm_realloc(cache->hashes, sizeof(uint64_t) * cache->alloc);
     }
-    cache->keys[cache->len] = rblock;
-    cache->values[cache->len] = value;
-    cache->len += 1;
+    size_t entry = cache->len++;
+    cache->keys[entry] = rblock;
+    cache->values[entry] = value;
+    cache->sigs[entry] = vm_cache_sig(rblock, 0);
+    cache->hashes[entry] = vm_cache_hash(rblock);
+    if (cache->len * 2 > cache->index_alloc) {
+        cache->index_alloc = cache->index_alloc == 0 ? 8 : cache->index_alloc * 2;
+        cache->index = vm_realloc(cache->index, sizeof(uint32_t) * cache->index_alloc);
+        memset(cache->index, 0, sizeof(uint32_t) * cache->index_alloc);
+        for (size_t i = 0; i < cache->len; i++) {
+            vm_cache_index_insert(cache, i);
+        }
+    } else {
+        vm_cache_index_insert(cache, entry);
+    }
+}
+
+size_t vm_cache_versions(vm_cache_t *cache) {
+    return cache->len;
 }
 
 vm_tags_t *vm_rblock_regs_empty(size_t ntags) {
     vm_tags_t *ret = vm_malloc(sizeof(vm_tags_t));
     ret->ntags = ntags;
-    ret->tags = vm_malloc(sizeof(vm_tag_t) * ntags);
+    ret->tags = vm_malloc_atomic(sizeof(vm_tag_t) * ntags);
     for (size_t i = 0; i < ntags; i++) {
         ret->tags[i] = VM_TAG_UNK;
     }
@@ -77,7 +126,7 @@ vm_tags_t *vm_rblock_regs_empty(size_t ntags) {
 vm_tags_t *vm_rblock_regs_dup(vm_tags_t *regs, size_t ntags) {
     vm_tags_t *ret = vm_malloc(sizeof(vm_tags_t));
     ret->ntags = ntags;
-    ret->tags = vm_malloc(sizeof(vm_tag_t) * ntags);
+    ret->tags = vm_malloc_atomic(sizeof(vm_tag_t) * ntags);
     for (size_t i = 0; i < ret->ntags && i < regs->ntags; i++) {
         ret->tags[i] = regs->tags[i];
     }
@@ -99,6 +148,37 @@ bool vm_rblock_regs_match(vm_tags_t *a, vm_tags_t *b) {
     return true;
 }
 
+// the smallest number tag both sides fit in, floats win over ints and f32
+// cannot hold an i32 or i64, VM_TAG_UNK when either side is not a number
+vm_tag_t vm_rblock_type_join(vm_tag_t a, vm_tag_t b) {
+    if (a < VM_TAG_I8 || a > VM_TAG_F64 || b < VM_TAG_I8 || b > VM_TAG_F64) {
+        return VM_TAG_UNK;
+    }
+    vm_tag_t lo = a < b ? a : b;
+    vm_tag_t hi = a < b ? b : a;
+    if (hi == VM_TAG_F32 && (lo == VM_TAG_I32 || lo == VM_TAG_I64)) {
+        return VM_TAG_F64;
+    }
+    return hi;
+}
+
+static vm_tag_t vm_rblock_type_arg(vm_tags_t *types, vm_arg_t arg) {
+    if (arg.type == VM_ARG_REG) {
+        return types->tags[arg.reg];
+    }
+    if (arg.type == VM_ARG_LIT) {
+        return arg.lit.tag;
+    }
+    return VM_TAG_UNK;
+}
+
+static vm_tag_t vm_rblock_type_join_args(vm_tags_t *types, vm_arg_t *args) {
+    if (args[0].type == VM_ARG_NONE || args[1].type == VM_ARG_NONE) {
+        return VM_TAG_UNK;
+    }
+    return vm_rblock_type_join(vm_rblock_type_arg(types, args[0]), vm_rblock_type_arg(types, args[1]));
+}
+
 vm_instr_t vm_rblock_type_specialize_instr(vm_tags_t *types, vm_instr_t instr) {
     if (instr.op == VM_IOP_STD) {
         instr.tag = VM_TAG_TAB;
@@ -114,10 +194,26 @@ vm_instr_t vm_rblock_type_specialize_instr(vm_tags_t *types, vm_instr_t instr) {
         instr.tag = VM_TAG_TAB;
         return instr;
     }
+    if (instr.op == VM_IOP_CLOSURE) {
+        instr.tag = VM_TAG_CLOSURE;
+        return instr;
+    }
+    if (instr.op == VM_IOP_UPVAL) {
+        return instr;
+    }
     if (instr.op == VM_IOP_LEN) {
-        instr.tag = VM_TAG_F64;
+        if (instr.tag == VM_TAG_UNK) {
+            instr.tag = VM_TAG_F64;
+        }
         return instr;
     }
+    if (instr.tag == VM_TAG_UNK && (instr.op == VM_IOP_ADD || instr.op == VM_IOP_SUB || instr.op == VM_IOP_MUL || instr.op == VM_IOP_DIV || instr.op == VM_IOP_MOD)) {
+        vm_tag_t tag = vm_rblock_type_join_args(types, instr.args);
+        if (tag != VM_TAG_UNK) {
+            instr.tag = tag;
+            return instr;
+        }
+    }
     if (instr.tag == VM_TAG_UNK) {
         for (size_t i = 0; instr.args[i].type != VM_ARG_NONE; i++) {
             if (instr.args[i].type == VM_ARG_REG) {
@@ -142,6 +238,13 @@ vm_branch_t vm_rblock_type_specialize_branch(vm_tags_t *types, vm_branch_t branc
     } else if (branch.op == VM_BOP_CALL) {
         return branch;
     } else if (branch.tag == VM_TAG_UNK) {
+        if (branch.op == VM_BOP_BEQ || branch.op == VM_BOP_BLT) {
+            vm_tag_t tag = vm_rblock_type_join_args(types, branch.args);
+            if (tag != VM_TAG_UNK) {
+                branch.tag = tag;
+                return branch;
+            }
+        }
         for (size_t i = 0; branch.args[i].type != VM_ARG_NONE; i++) {
             if (branch.args[i].type == VM_ARG_REG) {
                 branch.tag = types->tags[branch.args[i].reg];
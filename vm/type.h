@@ -8,9 +8,11 @@ vm_rblock_t *vm_rblock_new(vm_block_t *block, vm_tags_t *regs);
 void vm_cache_new(vm_cache_t *cache);
 void *vm_cache_get(vm_cache_t *cache, vm_rblock_t *rblock);
 void vm_cache_set(vm_cache_t *cache, vm_rblock_t *rblock, void *value);
+size_t vm_cache_versions(vm_cache_t *cache);
 vm_tags_t *vm_rblock_regs_empty(size_t nregs);
 vm_tags_t *vm_rblock_regs_dup(vm_tags_t *regs, size_t nregs);
 bool vm_rblock_regs_match(vm_tags_t *a, vm_tags_t *b);
+vm_tag_t vm_rblock_type_join(vm_tag_t a, vm_tag_t b);
 vm_instr_t vm_rblock_type_specialize_instr(vm_tags_t *a, vm_instr_t instr);
 vm_branch_t vm_rblock_type_specialize_branch(vm_tags_t *a, vm_branch_t block);
 